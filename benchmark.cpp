@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "rear_coded_array.policy.hpp"
+
+template<typename F, class V>
+size_t query_ns(F f, const V &queries) {
+    using timer = std::chrono::high_resolution_clock;
+    auto start = timer::now();
+    auto cnt = 0;
+    for (auto &q: queries)
+        cnt += f(q);
+    auto stop = timer::now();
+    [[maybe_unused]] volatile auto tmp = cnt;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count() / queries.size();
+}
+
+std::vector<std::string> read_strings(const std::string &path, size_t limit = -1) {
+    auto previous_value = std::ios::sync_with_stdio(false);
+    std::vector<std::string> result;
+    std::ifstream in(path.c_str());
+    std::string str;
+    while (std::getline(in, str) && limit-- > 0)
+        result.push_back(str);
+    std::ios::sync_with_stdio(previous_value);
+    return result;
+}
+
+/** Checks the array on the queries, and prints its size and query times. */
+template<typename Array>
+void run(const char *name, const Array &rca, const std::vector<std::string> &data,
+         const std::vector<size_t> &positions) {
+    char buffer[1024];
+    std::vector<std::string> queries;
+    queries.reserve(positions.size());
+    for (auto i: positions) {
+        queries.push_back(data[i]);
+        rca.access(i, buffer);
+        if (rca.rank(data[i]) != i + 1 || data[i] != buffer)
+            throw std::runtime_error(std::string(name) + ": mismatch at " + std::to_string(i));
+    }
+
+    auto rank_ns = query_ns([&](auto &s) { return rca.rank(s); }, queries);
+    auto access_ns = query_ns([&](auto i) { return rca.access(i, buffer) - buffer; }, positions);
+    std::printf("%-24s %12zu %10zu %10zu\n", name, rca.size_in_bytes(), rank_ns, access_ns);
+}
+
+/** Builds the array of the given policy, and runs it. */
+template<typename Policy>
+void run(const char *name, const std::vector<std::string> &data, size_t block_size,
+         const std::vector<size_t> &positions) {
+    run(name, rca::PolicyArray<Policy>(data.begin(), data.end(), block_size), data, positions);
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::string> data = read_strings(argc > 1 ? argv[1] : "/usr/share/dict/words");
+    std::printf("Read %zu lines\n", data.size());
+    std::sort(data.begin(), data.end());
+    data.erase(std::unique(data.begin(), data.end()), data.end());
+    if (!data.empty() && data.front().empty())
+        data.erase(data.begin());
+    if (data.empty())
+        return 0;
+
+    std::mt19937 gen;
+    std::uniform_int_distribution<size_t> distribution(0, data.size() - 1);
+    std::vector<size_t> positions(1000000);
+    std::generate(positions.begin(), positions.end(), [&] { return distribution(gen); });
+
+    using rca::ArrayPolicy;
+    using rca::HeaderPlacement;
+    using rca::RearLengthCodec;
+    for (auto block_size: {32, 128, 512, 2048}) {
+        std::printf("%s\n", std::string(79, '=').c_str());
+        std::printf("%-24s %12s %10s %10s\n", ("block_bytes " + std::to_string(block_size)).c_str(), "bytes",
+                    "rank (ns)", "access (ns)");
+        run<ArrayPolicy<HeaderPlacement::Inline>>("inline", data, block_size, positions);
+        run<ArrayPolicy<HeaderPlacement::Inline, RearLengthCodec::Varint, uint64_t>>(
+            "inline 64", data, block_size, positions);
+        run<ArrayPolicy<HeaderPlacement::Separate>>("separate varint", data, block_size, positions);
+        run<ArrayPolicy<HeaderPlacement::Separate, RearLengthCodec::Varint, uint64_t>>(
+            "separate varint 64", data, block_size, positions);
+        run<ArrayPolicy<HeaderPlacement::Separate, RearLengthCodec::Split>>("separate split", data, block_size,
+                                                                            positions);
+        run<ArrayPolicy<HeaderPlacement::Separate, RearLengthCodec::Split, uint64_t>>(
+            "separate split 64", data, block_size, positions);
+        run<ArrayPolicy<HeaderPlacement::Separate, RearLengthCodec::Runtime>>("separate runtime", data, block_size,
+                                                                              positions);
+
+        RearCodedArray::Options options;
+        options.block_bytes = block_size;
+        options.huffman_suffixes = true;
+        run("separate huffman", RearCodedArray(data.begin(), data.end(), options), data, positions);
+
+        options.huffman_suffixes = false;
+        options.compact_directory = true;
+        run("separate compact", RearCodedArray(data.begin(), data.end(), options), data, positions);
+        run("inline compact", InlineRearCodedArray(data.begin(), data.end(), block_size, true), data, positions);
+    }
+
+    // INTERLEAVING THE UNSORTED QUERIES HIDES THE CACHE MISSES OF EACH, SO IT PAYS OFF WHEN THE ARRAY EXCEEDS THE LLC
+    std::printf("%s\n", std::string(79, '=').c_str());
+    std::printf("%-24s %12s %10s %10s\n", "unsorted rank", "bytes", "rank (ns)", "lanes (ns)");
+    RearCodedArray rca(data.begin(), data.end(), RearCodedArray::Options{});
+    std::vector<std::string> queries;
+    queries.reserve(positions.size());
+    for (auto i: positions)
+        queries.push_back(data[i]);
+    std::vector<size_t> ranks(queries.size());
+    auto rank_ns = query_ns([&](auto &s) { return rca.rank(s); }, queries);
+    auto start = std::chrono::high_resolution_clock::now();
+    rca.rank_interleaved(queries.begin(), queries.end(), ranks.begin());
+    auto stop = std::chrono::high_resolution_clock::now();
+    for (size_t k = 0; k < queries.size(); ++k)
+        if (ranks[k] != positions[k] + 1)
+            throw std::runtime_error("rank_interleaved: mismatch at " + std::to_string(positions[k]));
+    auto interleaved_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count() / queries.size();
+    std::printf("%-24s %12zu %10zu %10zu\n", "separate varint", rca.size_in_bytes(), rank_ns, size_t(interleaved_ns));
+
+    return 0;
+}
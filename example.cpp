@@ -1,10 +1,23 @@
+#include <atomic>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <optional>
 #include <random>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "rear_coded_array.hpp"
 #include "rear_coded_array.separate_headers.hpp"
+#include "rear_coded_array.dynamic.hpp"
+#include "rear_coded_array.merge.hpp"
+#include "rear_coded_array.sharded.hpp"
+#include "rear_coded_array.tuner.hpp"
 
 template<typename F, class V>
 size_t query_ns(F f, const V &queries) {
@@ -18,6 +31,39 @@ size_t query_ns(F f, const V &queries) {
     return std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count() / queries.size();
 }
 
+template<typename F>
+size_t batch_ns(F f, size_t queries) {
+    using timer = std::chrono::high_resolution_clock;
+    auto start = timer::now();
+    f();
+    auto stop = timer::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count() / queries;
+}
+
+template<typename F, class V>
+double throughput_mops(F f, const V &queries, size_t threads) {
+    using timer = std::chrono::high_resolution_clock;
+    std::atomic<bool> go(false);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            char buffer[1024];
+            size_t cnt = 0;
+            while (!go.load(std::memory_order_acquire));
+            for (size_t i = 0; i < queries.size(); ++i)
+                cnt += f(queries[(i + t * queries.size() / threads) % queries.size()], buffer);
+            [[maybe_unused]] volatile auto tmp = cnt;
+        });
+    }
+    auto start = timer::now();
+    go.store(true, std::memory_order_release);
+    for (auto &w: workers)
+        w.join();
+    auto stop = timer::now();
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
+    return double(threads * queries.size()) / std::max<decltype(us)>(us, 1);
+}
+
 std::vector<std::string> read_strings(const std::string &path, size_t limit = -1) {
     auto previous_value = std::ios::sync_with_stdio(false);
     std::vector<std::string> result;
@@ -29,24 +75,93 @@ std::vector<std::string> read_strings(const std::string &path, size_t limit = -1
     return result;
 }
 
-int main() {
-    std::vector<std::string> data = read_strings("/usr/share/dict/words");
+int main(int argc, char **argv) {
+    std::vector<std::string> data = read_strings(argc > 1 ? argv[1] : "/usr/share/dict/words");
     std::cout << "Read " << data.size() << " lines" << std::endl;
     std::sort(data.begin(), data.end());
 
     for (auto block_size: {32, 128, 512, 2048}) {
         std::cout << std::string(79, '=') << std::endl;
         RearCodedArray rca(data.begin(), data.end(), block_size);
+        rca.build_stats().print(std::cout);
 
         // TEST ACCESS AND RANK
         char buffer[1024];
-        for (auto i = 0; i < data.size(); ++i) {
+        for (size_t i = 0; i < data.size(); ++i) {
             rca.access(i, buffer);
             if (std::string(buffer) != data[i])
                 throw std::runtime_error("Mismatch at " + std::to_string(i));
             if (rca.rank(data[i]) != i + 1)
                 throw std::runtime_error("Rank mismatch at " + std::to_string(i));
+            if (rca.locate(data[i]) != i)
+                throw std::runtime_error("Locate mismatch at " + std::to_string(i));
         }
+        std::vector<size_t> ranks(data.size());
+        rca.rank_batch(data.begin(), data.end(), ranks.begin());
+        for (size_t i = 0; i < data.size(); ++i)
+            if (ranks[i] != i + 1)
+                throw std::runtime_error("Batch rank mismatch at " + std::to_string(i));
+        if (!std::equal(rca.begin(), rca.end(), data.begin(), data.end()))
+            throw std::runtime_error("Iterator mismatch");
+        for (size_t i = 0; i < data.size(); i += 101) {
+            auto prefix = data[i].substr(0, data[i].length() / 2);
+            auto lo = std::lower_bound(data.begin(), data.end(), prefix) - data.begin();
+            auto hi = std::partition_point(data.begin() + lo, data.end(), [&](auto &s) {
+                return s.compare(0, prefix.length(), prefix) == 0;
+            }) - data.begin();
+            if (rca.prefix_range(prefix) != std::make_pair<size_t, size_t>(lo, hi))
+                throw std::runtime_error("Prefix range mismatch at " + std::to_string(i));
+        }
+
+        // TEST THE INLINE HEADERS ON THE SAME QUERIES
+        InlineRearCodedArray inline_rca(data.begin(), data.end(), block_size);
+        inline_rca.rank_batch(data.begin(), data.end(), ranks.begin());
+        for (size_t i = 0; i < data.size(); ++i)
+            if (ranks[i] != i + 1)
+                throw std::runtime_error("Inline batch rank mismatch at " + std::to_string(i));
+
+        // TEST THE OFFSET WIDTHS: NARROW OFFSETS MUST THROW RATHER THAN TRUNCATE, 64-BIT ONES MUST AGREE
+        if (data.size() > std::numeric_limits<uint16_t>::max()) {
+            auto throws_length_error = [&](auto build) {
+                try {
+                    build();
+                } catch (const std::length_error &) {
+                    return true;
+                }
+                return false;
+            };
+            if (!throws_length_error([&] { BasicRearCodedArray<uint16_t>(data.begin(), data.end(), block_size); }))
+                throw std::runtime_error("No length_error from 16-bit offsets");
+            auto build_inline16 = [&] { BasicInlineRearCodedArray<uint16_t>(data.begin(), data.end(), block_size); };
+            if (!throws_length_error(build_inline16))
+                throw std::runtime_error("No length_error from 16-bit inline offsets");
+        }
+        RearCodedArray64 rca64(data.begin(), data.end(), block_size);
+        auto path64 = (std::filesystem::temp_directory_path() / "rear_coded_array_example.64.bin").string();
+        rca64.save(path64);
+        auto loaded64 = RearCodedArray64::load(path64, true);
+        std::remove(path64.c_str());
+        char buffer64[1024];
+        for (size_t i = 0; i < data.size(); ++i) {
+            rca.access(i, buffer);
+            for (auto array: {&rca64, &loaded64}) {
+                array->access(i, buffer64);
+                if (std::strcmp(buffer, buffer64) != 0 || array->rank(data[i]) != rca.rank(data[i]))
+                    throw std::runtime_error("64-bit offsets mismatch at " + std::to_string(i));
+            }
+        }
+
+        // MEASURE PARALLEL CONSTRUCTION TIME
+        RearCodedArray::Options options{size_t(block_size)};
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+        auto build_start = std::chrono::high_resolution_clock::now();
+        RearCodedArray parallel(data.begin(), data.end(), options);
+        auto build_stop = std::chrono::high_resolution_clock::now();
+        if (!std::equal(parallel.begin(), parallel.end(), data.begin(), data.end()))
+            throw std::runtime_error("Parallel construction mismatch");
+        std::cout << "Build time (ms)         "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(build_stop - build_start).count()
+                  << " with " << options.threads << " threads" << std::endl;
 
         // MEASURE RANK TIME
         std::vector<std::string> queries;
@@ -54,7 +169,453 @@ int main() {
         std::sample(data.begin(), data.end(), std::back_inserter(queries), 1000000, gen);
         std::shuffle(queries.begin(), queries.end(), gen);
         std::cout << "Rank time (ns)          " << query_ns([&](auto &s) { return rca.rank(s); }, queries) << std::endl;
+        std::vector<size_t> interleaved_ranks(queries.size());
+        std::cout << "Interleaved rank (ns)   " << batch_ns([&] {
+            rca.rank_interleaved(queries.begin(), queries.end(), interleaved_ranks.begin());
+        }, queries.size()) << std::endl;
+        for (size_t k = 0; k < queries.size(); ++k)
+            if (interleaved_ranks[k] != rca.rank(queries[k]))
+                throw std::runtime_error("Interleaved rank mismatch at " + std::to_string(k));
+
+        // MEASURE RANK TIME WITH THE HEADER INDEX
+        RearCodedArray::Options indexed_options{size_t(block_size)};
+        indexed_options.header_index = true;
+        RearCodedArray indexed(data.begin(), data.end(), indexed_options);
+        std::cout << "Indexed rank time (ns)  "
+                  << query_ns([&](auto &s) { return indexed.rank(s); }, queries) << std::endl;
+        auto boundary_queries = queries;
+        boundary_queries.insert(boundary_queries.end(), {"", "\x01", data.front().substr(0, data.front().size() - 1),
+                                                         data.back() + "~", data.back() + "\xff", "\xff\xff"});
+        for (auto &q: boundary_queries)
+            if (indexed.rank(q) != rca.rank(q))
+                throw std::runtime_error("Indexed rank mismatch on " + q);
+
+        // MEASURE RANK TIME WITH GROUPED HEADERS
+        RearCodedArray::Options grouped_options{size_t(block_size)};
+        grouped_options.header_group = 4;
+        RearCodedArray grouped(data.begin(), data.end(), grouped_options);
+        std::cout << "Grouped rank time (ns)  "
+                  << query_ns([&](auto &s) { return grouped.rank(s); }, queries) << std::endl;
+        grouped_options.header_group = 3; // A group size that leaves the last group partial
+        while (rca.blocks_count() > grouped_options.header_group
+               && rca.blocks_count() % grouped_options.header_group == 0)
+            ++grouped_options.header_group;
+        RearCodedArray uneven_grouped(data.begin(), data.end(), grouped_options);
+        for (auto &q: boundary_queries)
+            if (grouped.rank(q) != rca.rank(q) || uneven_grouped.rank(q) != rca.rank(q))
+                throw std::runtime_error("Grouped rank mismatch on " + q);
+
+        // MEASURE RANK TIME ON SORTED QUERIES
+        auto sorted_queries = queries;
+        std::sort(sorted_queries.begin(), sorted_queries.end());
+        std::cout << "Sorted rank time (ns)   "
+                  << query_ns([&](auto &s) { return rca.rank(s); }, sorted_queries) << std::endl;
+        ranks.resize(sorted_queries.size());
+        std::cout << "Sorted rank_batch (ns)  " << batch_ns([&] {
+            rca.rank_batch(sorted_queries.begin(), sorted_queries.end(), ranks.begin());
+        }, sorted_queries.size()) << std::endl;
+
+        // MEASURE LOCATE TIME ON MISSES, WITH AND WITHOUT FILTER
+        std::vector<std::string> misses;
+        for (auto &q: queries)
+            if (!std::binary_search(data.begin(), data.end(), q + "$"))
+                misses.push_back(q + "$");
+        RearCodedArray filtered(data.begin(), data.end(), RearCodedArray::Options{size_t(block_size), 10});
+        std::cout << "Locate hit time (ns)    "
+                  << query_ns([&](auto &s) { return rca.locate(s).has_value(); }, queries) << std::endl;
+        std::cout << "Locate miss time (ns)   "
+                  << query_ns([&](auto &s) { return rca.locate(s).has_value(); }, misses) << std::endl;
+        std::cout << "Filtered miss time (ns) "
+                  << query_ns([&](auto &s) { return filtered.locate(s).has_value(); }, misses) << std::endl;
+        for (auto &q: queries)
+            if (filtered.locate(q) != rca.locate(q))
+                throw std::runtime_error("Filtered locate mismatch on " + q);
+        for (auto &q: misses)
+            if (filtered.locate(q).has_value())
+                throw std::runtime_error("Filtered locate found the miss " + q);
+
+        // MEASURE PREFIX RANGE TIME
+        std::vector<std::string> prefixes(queries.size());
+        std::transform(queries.begin(), queries.end(), prefixes.begin(), [](auto &s) { return s.substr(0, 3); });
+        std::cout << "Prefix range time (ns)  "
+                  << query_ns([&](auto &s) { return rca.prefix_range(s).second; }, prefixes) << std::endl;
+
+        // MEASURE ACCESS TIME ON SORTED POSITIONS
+        std::vector<size_t> positions(queries.size());
+        std::uniform_int_distribution<size_t> distribution(0, data.size() - 1);
+        std::generate(positions.begin(), positions.end(), [&] { return distribution(gen); });
+        auto sorted_positions = positions;
+        std::sort(sorted_positions.begin(), sorted_positions.end());
+        std::cout << "Sorted access time (ns) "
+                  << query_ns([&](auto i) { return rca.access(i, buffer) - buffer; }, sorted_positions) << std::endl;
+        std::string bytes;
+        std::vector<size_t> offsets;
+        std::cout << "Sorted access_batch(ns) " << batch_ns([&] {
+            rca.access_batch(sorted_positions.begin(), sorted_positions.end(), bytes, offsets);
+        }, sorted_positions.size()) << std::endl;
+        std::cout << "Scan time (ns)          " << batch_ns([&] {
+            size_t cnt = 0;
+            rca.access_range(0, data.size(), [&](std::string_view s) { cnt += s.size(); });
+            [[maybe_unused]] volatile auto tmp = cnt;
+        }, data.size()) << std::endl;
+        std::cout << "Iterator scan time (ns) " << batch_ns([&] {
+            size_t cnt = 0;
+            for (auto s: rca)
+                cnt += s.size();
+            [[maybe_unused]] volatile auto tmp = cnt;
+        }, data.size()) << std::endl;
+
+        // MEASURE ACCESS TIME WITH THE COMPACT BLOCK DIRECTORY
+        RearCodedArray::Options compact_options{size_t(block_size)};
+        compact_options.compact_directory = true;
+        RearCodedArray compact(data.begin(), data.end(), compact_options);
+        std::cout << "Access time (ns)        "
+                  << query_ns([&](auto i) { return rca.access(i, buffer) - buffer; }, positions) << std::endl;
+        std::cout << "Compact access (ns)     "
+                  << query_ns([&](auto i) { return compact.access(i, buffer) - buffer; }, positions) << std::endl;
+        std::cout << "Compact rank time (ns)  "
+                  << query_ns([&](auto &s) { return compact.rank(s); }, queries) << std::endl;
+        auto compact_path = (std::filesystem::temp_directory_path() / "rear_coded_array_example.compact.bin").string();
+        compact.save(compact_path);
+        auto loaded_compact = RearCodedArray::load(compact_path, true);
+        std::remove(compact_path.c_str());
+        for (auto array: {&compact, &loaded_compact}) {
+            for (auto i: positions) {
+                array->access(i, buffer);
+                if (std::string(buffer) != data[i])
+                    throw std::runtime_error("Compact access mismatch at " + std::to_string(i));
+            }
+            for (auto &q: queries)
+                if (array->rank(q) != rca.rank(q))
+                    throw std::runtime_error("Compact rank mismatch on " + q);
+        }
+
+        // MEASURE ACCESS TIME WITH THE SAMPLED POSITIONS
+        RearCodedArray::Options sampled_options{size_t(block_size)};
+        sampled_options.position_samples = true;
+        RearCodedArray sampled(data.begin(), data.end(), sampled_options);
+        std::cout << "Sampled access (ns)     "
+                  << query_ns([&](auto i) { return sampled.access(i, buffer) - buffer; }, positions) << std::endl;
+        for (size_t i = 0; i < data.size(); ++i) {
+            sampled.access(i, buffer);
+            if (std::string(buffer) != data[i])
+                throw std::runtime_error("Sampled access mismatch at " + std::to_string(i));
+        }
+
+        // MEASURE RANK AND ACCESS TIME WITH THE SPLIT BLOCK LAYOUT
+        RearCodedArray::Options split_options{size_t(block_size)};
+        split_options.split_streams = true;
+        RearCodedArray split(data.begin(), data.end(), split_options);
+        std::cout << "Split rank time (ns)    "
+                  << query_ns([&](auto &s) { return split.rank(s); }, queries) << std::endl;
+        std::cout << "Split access (ns)       "
+                  << query_ns([&](auto i) { return split.access(i, buffer) - buffer; }, positions) << std::endl;
+        std::cout << "Split prefix range (ns) "
+                  << query_ns([&](auto &s) { return split.prefix_range(s).second; }, prefixes) << std::endl;
+        for (auto &s: prefixes)
+            if (split.prefix_range(s) != rca.prefix_range(s))
+                throw std::runtime_error("Split prefix range mismatch on " + s);
+        for (size_t k = 0; k < queries.size(); k += 97)
+            for (size_t length = 0; length <= queries[k].length(); ++length)
+                if (split.prefix_range(queries[k].substr(0, length)) != rca.prefix_range(queries[k].substr(0, length)))
+                    throw std::runtime_error("Split prefix range mismatch on " + queries[k].substr(0, length));
+
+        // MEASURE SPACE, RANK AND ACCESS TIME WITH HUFFMAN-CODED SUFFIXES
+        RearCodedArray::Options huffman_options{size_t(block_size)};
+        huffman_options.huffman_suffixes = true;
+        RearCodedArray huffman(data.begin(), data.end(), huffman_options);
+        std::cout << "Huffman bytes           " << huffman.size_in_bytes() << " vs " << rca.size_in_bytes()
+                  << std::endl;
+        std::cout << "Huffman rank time (ns)  "
+                  << query_ns([&](auto &s) { return huffman.rank(s); }, queries) << std::endl;
+        std::cout << "Huffman access (ns)     "
+                  << query_ns([&](auto i) { return huffman.access(i, buffer) - buffer; }, positions) << std::endl;
+
+        // MEASURE ACCESS TIME WITH A CACHE OF DECODED BLOCKS ON SKEWED POSITIONS
+        std::vector<size_t> hot_positions(1000);
+        std::generate(hot_positions.begin(), hot_positions.end(), [&] { return distribution(gen); });
+        std::vector<size_t> skewed_positions(positions.size());
+        std::generate(skewed_positions.begin(), skewed_positions.end(), [&] {
+            return gen() % 10 == 0 ? distribution(gen) : hot_positions[gen() % hot_positions.size()];
+        });
+        rca::BlockCache cache(16 << 20);
+        std::cout << "Skewed access (ns)      "
+                  << query_ns([&](auto i) { return rca.access(i, buffer) - buffer; }, skewed_positions) << std::endl;
+        std::cout << "Cached access (ns)      "
+                  << query_ns([&](auto i) { return rca.access(i, buffer, cache) - buffer; }, skewed_positions)
+                  << ", hit rate " << cache.hit_rate() << ", " << cache.size_in_bytes() << " bytes" << std::endl;
+        for (auto i: skewed_positions) {
+            rca.access(i, buffer, cache);
+            if (std::string(buffer) != data[i])
+                throw std::runtime_error("Cached access mismatch at " + std::to_string(i));
+        }
+        rca::BlockCache shared_cache(64 << 10); // Small enough to evict while the threads read it
+        std::atomic<bool> shared_cache_ok(true);
+        std::vector<std::thread> readers;
+        for (size_t t = 0; t < 4; ++t) {
+            readers.emplace_back([&, t] {
+                char reader_buffer[1024];
+                for (size_t k = t; k < skewed_positions.size(); k += 4) {
+                    auto i = skewed_positions[k];
+                    rca.access(i, reader_buffer, shared_cache);
+                    if (std::string(reader_buffer) != data[i])
+                        shared_cache_ok = false;
+                }
+            });
+        }
+        for (auto &r: readers)
+            r.join();
+        if (!shared_cache_ok)
+            throw std::runtime_error("Concurrent cached access mismatch");
+
+        // MEASURE LOAD TIME OF A SAVED COPY
+        auto path = (std::filesystem::temp_directory_path() / "rear_coded_array_example.bin").string();
+        rca.save(path);
+        auto load_start = std::chrono::high_resolution_clock::now();
+        auto loaded = RearCodedArray::load(path);
+        auto load_stop = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < data.size(); ++i)
+            if (loaded.rank(data[i]) != i + 1)
+                throw std::runtime_error("Loaded rank mismatch at " + std::to_string(i));
+        std::cout << "Load time (us)          "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(load_stop - load_start).count() << std::endl;
+
+        // MEASURE STREAMED CONSTRUCTION TIME, WRITING DIRECTLY TO DISK
+        auto streamed_path = path + ".streamed";
+        std::cout << "Streamed build (ms)     " << batch_ns([&] {
+            RearCodedArrayBuilder builder(streamed_path, RearCodedArray::Options{size_t(block_size)});
+            for (auto &s: data)
+                builder.push_back(s);
+            builder.finish();
+        }, 1000000) << std::endl;
+        auto streamed = RearCodedArray::load(streamed_path, true);
+        if (!std::equal(streamed.begin(), streamed.end(), data.begin(), data.end()))
+            throw std::runtime_error("Streamed construction mismatch");
+        for (auto field: rca::build_stats_input_fields)
+            if (streamed.build_stats().*field != rca.build_stats().*field)
+                throw std::runtime_error("Streamed statistics mismatch");
+        std::remove(streamed_path.c_str());
+        std::remove(path.c_str());
+
+        // MEASURE MULTI-THREADED THROUGHPUT ON ONE SHARED INSTANCE
+        size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t threads = 1; threads <= max_threads; threads = threads == max_threads ? threads + 1
+                                                                   : std::min(2 * threads, max_threads)) {
+            auto rank_mops = throughput_mops([&](auto &s, char *) { return rca.rank(s); }, queries, threads);
+            auto access_mops = throughput_mops([&](auto i, char *buffer) { return rca.access(i, buffer) - buffer; },
+                                               positions, threads);
+            std::cout << "Threads " << threads << (threads < 10 ? "               " : "              ")
+                      << "rank " << rank_mops << " Mops/s, access " << access_mops << " Mops/s" << std::endl;
+        }
+
+#ifdef RCA_INSTRUMENT
+        rca::query_stats().print(std::cout);
+        rca::query_stats() = {};
+#endif
+    }
+
+    // SPLIT THE STRINGS INTO SHARDS BUILT AND QUERIED IN PARALLEL
+    std::cout << std::string(79, '=') << std::endl;
+    {
+        std::mt19937 gen;
+        std::vector<std::string> queries;
+        std::sample(data.begin(), data.end(), std::back_inserter(queries), 100000, gen);
+        std::shuffle(queries.begin(), queries.end(), gen);
+        std::vector<std::string> misses;
+        for (auto &q: queries)
+            if (!std::binary_search(data.begin(), data.end(), q + "$"))
+                misses.push_back(q + "$");
+        std::vector<size_t> positions(queries.size());
+        std::uniform_int_distribution<size_t> distribution(0, data.size() - 1);
+        std::generate(positions.begin(), positions.end(), [&] { return distribution(gen); });
+        std::vector<size_t> ranks(queries.size());
+        auto max_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        auto shards_count = 4 * max_threads + 1; // Not dividing the input, so that the shards differ in size
+        while (shards_count < data.size() && data.size() % shards_count == 0)
+            ++shards_count;
+
+        // Checks the batches, access and locate against the input, whose positions are global across the shards
+        auto check = [&](const rca::ShardedRearCodedArray<> &sharded, const std::string &name) {
+            auto expected_rank = [&](const std::string &s) {
+                return size_t(std::upper_bound(data.begin(), data.end(), s) - data.begin());
+            };
+            sharded.rank_batch(queries.begin(), queries.end(), ranks.begin());
+            for (size_t j = 0; j < queries.size(); ++j)
+                if (ranks[j] != expected_rank(queries[j]))
+                    throw std::runtime_error(name + " rank mismatch at " + std::to_string(j));
+            sharded.rank_batch(misses.begin(), misses.end(), ranks.begin());
+            for (size_t j = 0; j < misses.size(); ++j)
+                if (ranks[j] != expected_rank(misses[j]))
+                    throw std::runtime_error(name + " rank mismatch on " + misses[j]);
+            std::vector<std::string> strings;
+            sharded.access_batch(positions.begin(), positions.end(), strings);
+            char buffer[1024];
+            for (size_t j = 0; j < positions.size(); ++j) {
+                sharded.access(positions[j], buffer);
+                if (strings[j] != data[positions[j]] || buffer != data[positions[j]])
+                    throw std::runtime_error(name + " access mismatch at " + std::to_string(positions[j]));
+            }
+            for (auto &q: queries)
+                if (sharded.locate(q) != expected_rank(q) - 1)
+                    throw std::runtime_error(name + " locate mismatch on " + q);
+            for (auto &q: misses)
+                if (sharded.locate(q).has_value())
+                    throw std::runtime_error(name + " locate found the miss " + q);
+        };
+
+        std::cout << "Single build (ms)       " << batch_ns([&] {
+            RearCodedArray single(data.begin(), data.end(), RearCodedArray::Options{});
+        }, 1000000) << std::endl;
+        for (size_t threads = 1; threads <= max_threads; threads = threads == max_threads ? threads + 1
+                                                                   : std::min(2 * threads, max_threads)) {
+            std::optional<rca::ShardedRearCodedArray<>> sharded;
+            auto build_ms = batch_ns([&] {
+                sharded.emplace(data.begin(), data.end(), shards_count, RearCodedArray::Options{}, threads);
+            }, 1000000);
+            auto rank_batch_ns = batch_ns([&] {
+                sharded->rank_batch(queries.begin(), queries.end(), ranks.begin());
+            }, queries.size());
+            std::cout << "Threads " << threads << (threads < 10 ? "               " : "              ")
+                      << "sharded build " << build_ms << " ms, rank_batch " << rank_batch_ns << " ns" << std::endl;
+        }
+
+        rca::ShardedRearCodedArray<> sharded(data.begin(), data.end(), shards_count);
+        std::cout << "Sharded rank time (ns)  "
+                  << query_ns([&](auto &s) { return sharded.rank(s); }, queries) << std::endl;
+        check(sharded, "Sharded");
+
+        auto path = (std::filesystem::temp_directory_path() / "rear_coded_array_sharded.bin").string();
+        sharded.save(path);
+        auto loaded = rca::ShardedRearCodedArray<>::load(path);
+        if (loaded.rank(queries[0]) != sharded.rank(queries[0]))
+            throw std::runtime_error("Loaded sharded rank mismatch on " + queries[0]);
+        std::cout << "Loaded shards           " << loaded.loaded_shards_count() << " of " << loaded.shards_count()
+                  << " after one query" << std::endl;
+        check(loaded, "Loaded sharded");
+        std::remove(path.c_str());
+        for (size_t k = 0; k < sharded.shards_count(); ++k)
+            std::remove((path + "." + std::to_string(k)).c_str());
     }
 
+    // MERGE FOUR ARRAYS WITH OVERLAPPING STRINGS, VERSUS DECODING THEM AND BUILDING THE UNION FROM SCRATCH
+    std::cout << std::string(79, '=') << std::endl;
+    {
+        std::vector<RearCodedArray> shards;
+        for (size_t s = 0; s < 4; ++s) {
+            std::vector<std::string> shard;
+            for (size_t i = 0; i < data.size(); ++i)
+                if (i % 4 == s || i % 8 == 7 - s)
+                    shard.push_back(data[i]);
+            shards.emplace_back(shard.begin(), shard.end(), RearCodedArray::Options{});
+        }
+        std::vector<const RearCodedArray *> inputs;
+        for (auto &shard: shards)
+            inputs.push_back(&shard);
+        std::vector<std::vector<size_t>> remaps;
+        std::optional<RearCodedArray> merged;
+        std::cout << "Merge time (ms)         "
+                  << batch_ns([&] { merged.emplace(rca::merge(inputs, remaps)); }, 1000000) << std::endl;
+        std::cout << "Rebuild time (ms)       " << batch_ns([&] {
+            std::vector<std::string> strings;
+            for (auto &shard: shards)
+                strings.insert(strings.end(), shard.begin(), shard.end());
+            std::sort(strings.begin(), strings.end());
+            strings.erase(std::unique(strings.begin(), strings.end()), strings.end());
+            RearCodedArray rebuilt(strings.begin(), strings.end(), RearCodedArray::Options{});
+        }, 1000000) << std::endl;
+        if (!std::equal(merged->begin(), merged->end(), data.begin(), data.end()))
+            throw std::runtime_error("Merge mismatch");
+        for (size_t s = 0; s < shards.size(); ++s) {
+            auto it = shards[s].begin();
+            for (auto i: remaps[s])
+                if (*it++ != data[i])
+                    throw std::runtime_error("Remap mismatch in shard " + std::to_string(s));
+        }
+    }
+
+    // INSERT HALF OF THE STRINGS INTO A DICTIONARY WITH THE OTHER HALF, THEN DELETE A QUARTER OF THEM
+    std::cout << std::string(79, '=') << std::endl;
+    {
+        std::vector<std::string> even, odd;
+        for (size_t i = 0; i < data.size(); ++i)
+            (i % 2 ? odd : even).push_back(data[i]);
+        std::shuffle(odd.begin(), odd.end(), std::mt19937());
+        std::vector<std::string> expected = even;
+        for (size_t i = 1; i < odd.size(); i += 2)
+            expected.push_back(odd[i]);
+        std::sort(expected.begin(), expected.end());
+
+        // Checks rank() on every input string and access() on every position against the sorted strings
+        auto check = [&](const rca::DynamicRearCodedArray<> &dynamic, const std::vector<std::string> &strings,
+                         const std::string &stage) {
+            if (dynamic.size() != strings.size())
+                throw std::runtime_error("Dynamic size mismatch " + stage);
+            char buffer[1024];
+            for (auto &s: data)
+                if (dynamic.rank(s) != size_t(std::upper_bound(strings.begin(), strings.end(), s) - strings.begin()))
+                    throw std::runtime_error("Dynamic rank mismatch " + stage + " on " + s);
+            for (size_t i = 0; i < strings.size(); ++i) {
+                dynamic.access(i, buffer);
+                if (strings[i] != buffer)
+                    throw std::runtime_error("Dynamic access mismatch " + stage + " at " + std::to_string(i));
+            }
+        };
+
+        rca::DynamicRearCodedArray<> dynamic(even.begin(), even.end());
+        std::cout << "Insert time (ns)        " << batch_ns([&] {
+            for (auto &s: odd)
+                dynamic.insert(s);
+        }, std::max<size_t>(1, odd.size())) << std::endl;
+        check(dynamic, data, "after the insertions");
+        std::cout << "Erase time (ns)         " << batch_ns([&] {
+            for (size_t i = 0; i < odd.size(); i += 2)
+                dynamic.erase(odd[i]);
+        }, std::max<size_t>(1, (odd.size() + 1) / 2)) << std::endl;
+        check(dynamic, expected, "after the erasures");
+        std::cout << "Dynamic rank time (ns)  " << query_ns([&](auto &s) { return dynamic.rank(s); }, data)
+                  << std::endl;
+        dynamic.wait_for_merge();
+        check(dynamic, expected, "after the merge");
+        size_t k = 0;
+        dynamic.for_each([&](std::string_view s) {
+            if (k >= expected.size() || s != expected[k++])
+                throw std::runtime_error("Dynamic mismatch at " + std::to_string(k - 1));
+        });
+        if (k != expected.size())
+            throw std::runtime_error("Dynamic size mismatch");
+        std::cout << "Dynamic bytes           " << dynamic.size_in_bytes() << ", delta " << dynamic.delta_size()
+                  << std::endl;
+
+        // With a small threshold, the merges keep running while the updates go on, which rebases them on the result
+        rca::DynamicRearCodedArray<> rebased(even.begin(), even.end(), RearCodedArray::Options{}, 64);
+        for (auto &s: odd)
+            rebased.insert(s);
+        check(rebased, data, "after the insertions with merges");
+        for (size_t i = 0; i < odd.size(); i += 2)
+            rebased.erase(odd[i]);
+        check(rebased, expected, "after the erasures with merges");
+        rebased.wait_for_merge();
+        check(rebased, expected, "after the last merge");
+    }
+
+    // TUNE THE BLOCK SIZE ON A MIX OF RANKS AND ACCESSES, WITHIN THE SPACE OF THE INPUT
+    std::cout << std::string(79, '=') << std::endl;
+    rca::Workload workload;
+    std::mt19937 gen;
+    std::sample(data.begin(), data.end(), std::back_inserter(workload.ranks), 100000, gen);
+    std::shuffle(workload.ranks.begin(), workload.ranks.end(), gen);
+    std::uniform_int_distribution<size_t> distribution(0, data.size() - 1);
+    workload.accesses.resize(100000);
+    std::generate(workload.accesses.begin(), workload.accesses.end(), [&] { return distribution(gen); });
+    size_t input_bytes = 0;
+    for (auto &s: data)
+        input_bytes += s.length() + 1;
+    auto tuning = rca::tune(data.begin(), data.end(), workload, input_bytes);
+    for (auto &c: tuning.front)
+        std::cout << "Pareto block_bytes " << c.options.block_bytes << (c.options.split_streams ? " split" : "")
+                  << ", " << c.bytes << " bytes, " << c.query_ns << " ns/query" << std::endl;
+    std::cout << "Tuned block_bytes       " << tuning.best.block_bytes
+              << (tuning.best.split_streams ? " split" : "") << std::endl;
+
     return 0;
 }
@@ -0,0 +1,239 @@
+//
+// A size-bounded cache of decoded blocks shared by the RearCodedArray variants, for access workloads with hot blocks.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace rca {
+
+/**
+ * A cache of the decoded strings of the blocks of an array, keyed by block index, which can be passed to the queries of
+ * a single array by concurrent threads. The blocks are split into shards with a lock each, and evicted with the CLOCK
+ * policy: a hit only sets the referenced bit of its block, so that the readers of a shard share its lock and only the
+ * misses take it exclusively.
+ */
+class BlockCache {
+    /**
+     * The strings of a block in a single buffer, so that a hit reads few cache lines: the offsets where the strings
+     * start and where the last one ends, followed by the strings, each with a \0.
+     */
+    class Entry {
+        std::unique_ptr<char[]> buffer;
+        size_t strings = 0;
+        size_t bytes = 0;
+
+    public:
+
+        Entry() = default;
+
+        Entry(const std::string &chars, const std::vector<size_t> &offsets)
+            : buffer(new char[(offsets.size() + 1) * sizeof(size_t) + chars.length()]), strings(offsets.size()),
+              bytes((offsets.size() + 1) * sizeof(size_t) + chars.length()) {
+            auto base = (offsets.size() + 1) * sizeof(size_t);
+            for (size_t j = 0; j <= strings; ++j) {
+                auto offset = base + (j < strings ? offsets[j] : chars.length());
+                std::memcpy(buffer.get() + j * sizeof(size_t), &offset, sizeof(size_t));
+            }
+            std::memcpy(buffer.get() + base, chars.data(), chars.length());
+        }
+
+        std::string_view operator[](size_t j) const {
+            size_t begin, end;
+            std::memcpy(&begin, buffer.get() + j * sizeof(size_t), sizeof(size_t));
+            std::memcpy(&end, buffer.get() + (j + 1) * sizeof(size_t), sizeof(size_t));
+            return {buffer.get() + begin, end - begin - 1};
+        }
+
+        size_t size_in_bytes() const { return bytes; }
+    };
+
+    struct Slot {
+        size_t block = empty;
+        Entry entry;
+        std::atomic<bool> referenced{false};
+    };
+
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<size_t, Slot *> slot_of; ///< Slot of each cached block
+        std::deque<Slot> slots;                     ///< A deque, so that the slots do not move as it grows
+        std::vector<size_t> free_slots;
+        size_t hand = 0;
+        size_t bytes = 0;
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        uint64_t evictions = 0;
+    };
+
+    static constexpr size_t empty = std::numeric_limits<size_t>::max();
+    static constexpr size_t slot_overhead = sizeof(Slot) + sizeof(std::pair<const size_t, Slot *>) + 4 * sizeof(void *);
+
+    std::vector<Shard> shards;
+    size_t shard_capacity;
+
+    Shard &shard_of(size_t block) {
+        auto h = (block + 1) * 0x9e3779b97f4a7c15ull;
+        return shards[(h >> 32) % shards.size()];
+    }
+
+    /** Evicts blocks from the shard with the CLOCK policy until bytes more fit in it. Requires the exclusive lock. */
+    void make_room(Shard &shard, size_t bytes) {
+        while (shard.bytes + bytes > shard_capacity && shard.bytes > 0) {
+            auto i = shard.hand;
+            auto &slot = shard.slots[i];
+            shard.hand = (i + 1) % shard.slots.size();
+            if (slot.block == empty)
+                continue;
+            if (slot.referenced.load(std::memory_order_relaxed)) {
+                slot.referenced.store(false, std::memory_order_relaxed);
+                continue;
+            }
+            shard.bytes -= slot.entry.size_in_bytes() + slot_overhead;
+            shard.slot_of.erase(slot.block);
+            shard.free_slots.push_back(i);
+            slot.block = empty;
+            slot.entry = {};
+            ++shard.evictions;
+        }
+    }
+
+public:
+
+    /** Creates a cache that holds about capacity_bytes of decoded blocks, including its own bookkeeping. */
+    explicit BlockCache(size_t capacity_bytes, size_t shards_count = 16) : shards(shards_count) {
+        if (shards_count == 0)
+            throw std::invalid_argument("BlockCache needs at least one shard");
+        shard_capacity = capacity_bytes / shards_count;
+    }
+
+    BlockCache(const BlockCache &) = delete;
+    BlockCache &operator=(const BlockCache &) = delete;
+
+    /**
+     * Returns f(std::string_view) on the j-th string of the block. On a miss, the whole block is decoded outside the
+     * lock by decode(std::string &bytes, std::vector<size_t> &offsets), which appends to bytes its strings, each
+     * followed by a \0, and to offsets where each of them starts, and then cached if it fits.
+     */
+    template<typename Decode, typename F>
+    auto visit(size_t block, size_t j, Decode decode, F f) {
+        auto &shard = shard_of(block);
+        {
+            std::shared_lock lock(shard.mutex);
+            auto it = shard.slot_of.find(block);
+            if (it != shard.slot_of.end()) {
+                auto &slot = *it->second;
+                if (!slot.referenced.load(std::memory_order_relaxed))
+                    slot.referenced.store(true, std::memory_order_relaxed);
+                shard.hits.fetch_add(1, std::memory_order_relaxed);
+                return f(slot.entry[j]);
+            }
+        }
+
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+        thread_local std::string chars;
+        thread_local std::vector<size_t> offsets;
+        chars.clear();
+        offsets.clear();
+        decode(chars, offsets);
+        auto bytes = (offsets.size() + 1) * sizeof(size_t) + chars.length() + slot_overhead;
+        if (bytes > shard_capacity)
+            return f(std::string_view(chars.data() + offsets[j]));
+
+        Entry entry(chars, offsets);
+        std::unique_lock lock(shard.mutex);
+        auto it = shard.slot_of.find(block);
+        if (it != shard.slot_of.end()) // Decoded by another thread meanwhile
+            return f(it->second->entry[j]);
+        make_room(shard, bytes);
+        size_t i;
+        if (shard.free_slots.empty()) {
+            i = shard.slots.size();
+            shard.slots.emplace_back();
+        } else {
+            i = shard.free_slots.back();
+            shard.free_slots.pop_back();
+        }
+        auto &slot = shard.slots[i];
+        slot.block = block;
+        slot.entry = std::move(entry);
+        slot.referenced.store(true, std::memory_order_relaxed);
+        shard.slot_of.emplace(block, &slot);
+        shard.bytes += bytes;
+        return f(slot.entry[j]);
+    }
+
+    /** Returns the number of queries answered from the cache. */
+    uint64_t hits() const {
+        uint64_t total = 0;
+        for (auto &shard: shards)
+            total += shard.hits.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    /** Returns the number of queries that decoded their block. */
+    uint64_t misses() const {
+        uint64_t total = 0;
+        for (auto &shard: shards)
+            total += shard.misses.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    /** Returns the number of blocks evicted to make room for others. */
+    uint64_t evictions() const {
+        uint64_t total = 0;
+        for (auto &shard: shards) {
+            std::shared_lock lock(shard.mutex);
+            total += shard.evictions;
+        }
+        return total;
+    }
+
+    double hit_rate() const {
+        auto h = hits();
+        auto total = h + misses();
+        return total == 0 ? 0 : double(h) / double(total);
+    }
+
+    /** Returns the memory taken by the cached blocks, which adds to the size_in_bytes() of the array. */
+    size_t size_in_bytes() const {
+        size_t total = sizeof(*this) + shards.size() * sizeof(Shard);
+        for (auto &shard: shards) {
+            std::shared_lock lock(shard.mutex);
+            total += shard.bytes;
+        }
+        return total;
+    }
+
+    size_t capacity_bytes() const { return shard_capacity * shards.size(); }
+
+    /** Drops all the cached blocks and resets the counters, e.g. before using the cache with another array. */
+    void clear() {
+        for (auto &shard: shards) {
+            std::unique_lock lock(shard.mutex);
+            shard.slot_of.clear();
+            shard.slots.clear();
+            shard.free_slots.clear();
+            shard.hand = 0;
+            shard.bytes = 0;
+            shard.hits = 0;
+            shard.misses = 0;
+            shard.evictions = 0;
+        }
+    }
+};
+
+}
@@ -0,0 +1,521 @@
+//
+// An updatable dictionary made of a frozen RearCodedArray and a small sorted delta, merged in the background.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "rear_coded_array.separate_headers.hpp"
+
+namespace rca {
+
+/**
+ * A sequence split into chunks that are shared by its copies and never modified, so that copying it and then
+ * inserting or erasing an element takes time linear in the number of chunks and in the size of one chunk only.
+ */
+template<typename T>
+class ChunkedVector {
+    static constexpr size_t chunk_capacity = 128;
+
+    using Chunk = std::vector<T>;
+
+    std::vector<std::shared_ptr<const Chunk>> chunks;
+    std::vector<size_t> starts; ///< Index of the first element of each chunk
+    size_t count = 0;
+
+    /** Returns the chunk that holds the element at index i < size(), and the offset of the element in it. */
+    std::pair<size_t, size_t> find(size_t i) const {
+        auto c = size_t(std::upper_bound(starts.begin(), starts.end(), i) - starts.begin()) - 1;
+        return {c, i - starts[c]};
+    }
+
+    void update_starts(size_t from) {
+        for (auto c = from; c < chunks.size(); ++c)
+            starts[c] = c == 0 ? 0 : starts[c - 1] + chunks[c - 1]->size();
+    }
+
+public:
+
+    ChunkedVector() = default;
+
+    /** Creates a vector with the given elements, filling the chunks to half their maximum size. */
+    explicit ChunkedVector(std::vector<T> &&values) : count(values.size()) {
+        for (size_t i = 0; i < values.size(); i += chunk_capacity) {
+            auto end = std::min(values.size(), i + chunk_capacity);
+            starts.push_back(i);
+            chunks.push_back(std::make_shared<const Chunk>(std::make_move_iterator(values.begin() + i),
+                                                           std::make_move_iterator(values.begin() + end)));
+        }
+    }
+
+    /** Walks the elements in order. */
+    class Cursor {
+        const ChunkedVector *vector = nullptr;
+        size_t chunk = 0;
+        size_t offset = 0;
+
+    public:
+
+        Cursor() = default;
+
+        explicit Cursor(const ChunkedVector &vector) : vector(&vector) {}
+
+        bool done() const { return vector == nullptr || chunk == vector->chunks.size(); }
+
+        const T &operator*() const { return (*vector->chunks[chunk])[offset]; }
+
+        Cursor &operator++() {
+            if (++offset == vector->chunks[chunk]->size()) {
+                ++chunk;
+                offset = 0;
+            }
+            return *this;
+        }
+    };
+
+    size_t size() const { return count; }
+
+    bool empty() const { return count == 0; }
+
+    const T &operator[](size_t i) const {
+        auto [c, offset] = find(i);
+        return (*chunks[c])[offset];
+    }
+
+    /** Returns the first index i where p(i, (*this)[i]) is false, given that p is true before it and false after. */
+    template<typename P>
+    size_t partition_point(P p) const {
+        size_t c = 0;
+        size_t n = chunks.size();
+        while (n > 0) {
+            auto step = n / 2;
+            auto &chunk = *chunks[c + step];
+            if (p(starts[c + step] + chunk.size() - 1, chunk.back())) {
+                c += step + 1;
+                n -= step + 1;
+            } else
+                n = step;
+        }
+        if (c == chunks.size())
+            return count;
+        auto &chunk = *chunks[c];
+        size_t lo = 0;
+        n = chunk.size();
+        while (n > 0) {
+            auto step = n / 2;
+            if (p(starts[c] + lo + step, chunk[lo + step])) {
+                lo += step + 1;
+                n -= step + 1;
+            } else
+                n = step;
+        }
+        return starts[c] + lo;
+    }
+
+    void insert(size_t i, T value) {
+        if (i == count) {
+            push_back(std::move(value));
+            return;
+        }
+        auto [c, offset] = find(i);
+        auto chunk = std::make_shared<Chunk>(*chunks[c]);
+        chunk->insert(chunk->begin() + offset, std::move(value));
+        if (chunk->size() > 2 * chunk_capacity) {
+            auto half = std::make_shared<Chunk>(chunk->begin() + chunk_capacity, chunk->end());
+            chunk->resize(chunk_capacity);
+            chunks.insert(chunks.begin() + c + 1, std::move(half));
+            starts.insert(starts.begin() + c + 1, 0);
+        }
+        chunks[c] = std::move(chunk);
+        ++count;
+        update_starts(c + 1);
+    }
+
+    void erase(size_t i) {
+        auto [c, offset] = find(i);
+        if (chunks[c]->size() == 1) {
+            chunks.erase(chunks.begin() + c);
+            starts.erase(starts.begin() + c);
+        } else {
+            auto chunk = std::make_shared<Chunk>(*chunks[c]);
+            chunk->erase(chunk->begin() + offset);
+            chunks[c] = std::move(chunk);
+        }
+        --count;
+        update_starts(c);
+    }
+
+    void push_back(T value) {
+        if (chunks.empty() || chunks.back()->size() >= chunk_capacity) {
+            starts.push_back(count);
+            chunks.push_back(std::make_shared<const Chunk>());
+        }
+        auto chunk = std::make_shared<Chunk>(*chunks.back());
+        chunk->push_back(std::move(value));
+        chunks.back() = std::move(chunk);
+        ++count;
+    }
+
+    /** Returns the memory taken by the vector, with that of each element given by bytes(const T &). */
+    template<typename F>
+    size_t size_in_bytes(F bytes) const {
+        auto total = sizeof(*this) + chunks.capacity() * sizeof(chunks[0]) + starts.capacity() * sizeof(size_t);
+        for (auto &chunk: chunks) {
+            total += sizeof(Chunk) + 2 * sizeof(void *) + (chunk->capacity() - chunk->size()) * sizeof(T);
+            for (auto &x: *chunk)
+                total += bytes(x);
+        }
+        return total;
+    }
+};
+
+/**
+ * A sorted string dictionary that supports insertions and deletions. The strings are those of a frozen array, minus
+ * the deleted ones, plus the inserted ones, which are kept sorted in a delta. Queries combine the frozen array and the
+ * delta, which is small, so that ranks and positions are those of the whole set of strings. When the delta reaches the
+ * merge threshold, a background thread builds a new frozen array with the changes applied, while the queries and the
+ * updates keep using the current one, and then swaps it in.
+ *
+ * The queries run on an immutable snapshot of the frozen array and the delta, which each update replaces, so that they
+ * never wait for the updates nor hold them off, and each sees a consistent state. The updates are serialized, and
+ * share with the previous snapshot all the chunks of the delta but the one they modify.
+ */
+template<typename Array = RearCodedArray>
+class DynamicRearCodedArray {
+    using Options = typename Array::Options;
+
+    struct Inserted {
+        std::string string;
+        size_t rank; ///< Number of strings of the frozen array smaller than the string
+    };
+
+    /** The strings of a frozen array that are not deleted, merged with the inserted ones, in order. */
+    class UnionIterator {
+        typename Array::iterator frozen;
+        typename Array::iterator frozen_end;
+        typename ChunkedVector<size_t>::Cursor deleted;
+        typename ChunkedVector<Inserted>::Cursor inserted;
+        bool from_frozen = false;
+
+        void settle() {
+            while (frozen != frozen_end && !deleted.done() && *deleted == frozen.position()) {
+                ++frozen;
+                ++deleted;
+            }
+            from_frozen = frozen != frozen_end && (inserted.done() || *frozen < (*inserted).string);
+        }
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const std::string_view *;
+        using reference = std::string_view;
+
+        UnionIterator(const Array &array, const ChunkedVector<size_t> &deleted,
+                      const ChunkedVector<Inserted> &inserted)
+            : frozen(array.begin()), frozen_end(array.end()), deleted(deleted), inserted(inserted) {
+            settle();
+        }
+
+        /** Returns an iterator past the strings of the array. */
+        explicit UnionIterator(const Array &array) : frozen(array.end()), frozen_end(array.end()) {}
+
+        bool done() const { return frozen == frozen_end && inserted.done(); }
+
+        std::string_view operator*() const { return from_frozen ? *frozen : std::string_view((*inserted).string); }
+
+        UnionIterator &operator++() {
+            if (from_frozen)
+                ++frozen;
+            else
+                ++inserted;
+            settle();
+            return *this;
+        }
+
+        /** Compares equal to another iterator only if both are done or neither is, which suffices for a single pass. */
+        bool operator==(const UnionIterator &other) const { return done() == other.done(); }
+        bool operator!=(const UnionIterator &other) const { return !(*this == other); }
+    };
+
+    /** A frozen array and the changes to it, which is never modified once published. */
+    struct Snapshot {
+        std::shared_ptr<const Array> frozen;
+        ChunkedVector<Inserted> inserted; ///< Sorted strings not in frozen
+        ChunkedVector<size_t> deleted;    ///< Sorted positions in frozen of the deleted strings
+
+        explicit Snapshot(std::shared_ptr<const Array> frozen) : frozen(std::move(frozen)) {}
+
+        size_t size() const { return frozen->size() - deleted.size() + inserted.size(); }
+
+        /** Returns the index of the first inserted string >= s. */
+        size_t inserted_lower_bound(std::string_view s) const {
+            return inserted.partition_point([&](size_t, const Inserted &x) { return x.string < s; });
+        }
+
+        /** Returns the index of the first deleted position >= p. */
+        size_t deleted_lower_bound(size_t p) const {
+            return deleted.partition_point([&](size_t, size_t q) { return q < p; });
+        }
+
+        /** Returns the position in the whole set of the inserted string at index t. */
+        size_t inserted_position(size_t t, size_t rank) const { return t + rank - deleted_lower_bound(rank); }
+
+        /** Returns the position in frozen of its j-th string that is not deleted. */
+        size_t frozen_position(size_t j) const {
+            // deleted[k] - k strings that are not deleted precede the k-th deleted one, a non-decreasing sequence
+            return j + deleted.partition_point([&](size_t k, size_t q) { return q - k <= j; });
+        }
+    };
+
+    Options options;
+    size_t merge_threshold;
+
+    std::shared_ptr<const Snapshot> current; ///< Read and replaced with the atomic shared_ptr functions
+
+    std::mutex update_mutex;                 ///< Serializes the updates and the end of the merges
+    std::thread merger;
+    bool merging = false;
+    std::exception_ptr merge_error;
+
+    std::shared_ptr<const Snapshot> snapshot() const { return std::atomic_load(&current); }
+
+    void publish(std::shared_ptr<const Snapshot> next) { std::atomic_store(&current, std::move(next)); }
+
+    void rethrow_merge_error() {
+        if (merge_error)
+            std::rethrow_exception(std::exchange(merge_error, nullptr));
+    }
+
+    /** Starts a merge if the delta is large enough and none is running. Requires update_mutex. */
+    void maybe_merge() {
+        if (merging || current->inserted.size() + current->deleted.size() < merge_threshold)
+            return;
+        if (merger.joinable())
+            merger.join();
+        merging = true;
+        merger = std::thread([this, base = current] {
+            try {
+                auto merged = std::make_shared<const Array>(UnionIterator(*base->frozen, base->deleted, base->inserted),
+                                                            UnionIterator(*base->frozen), options);
+                std::lock_guard update_lock(update_mutex);
+                rebase(*base, std::move(merged));
+                merging = false;
+            } catch (...) {
+                std::lock_guard update_lock(update_mutex);
+                merge_error = std::current_exception();
+                merging = false;
+            }
+        });
+    }
+
+    /**
+     * Swaps in merged, which holds the strings of base with its changes applied, and expresses w.r.t. it the changes
+     * made since the merge started. Requires update_mutex, so that the current snapshot is stable.
+     */
+    void rebase(const Snapshot &base, std::shared_ptr<const Array> merged) {
+        auto strings = [](const ChunkedVector<Inserted> &v) {
+            std::vector<std::string> result;
+            for (typename ChunkedVector<Inserted>::Cursor it(v); !it.done(); ++it)
+                result.push_back((*it).string);
+            return result;
+        };
+        auto positions = [](const ChunkedVector<size_t> &v) {
+            std::vector<size_t> result;
+            for (typename ChunkedVector<size_t>::Cursor it(v); !it.done(); ++it)
+                result.push_back(*it);
+            return result;
+        };
+        auto base_inserted = strings(base.inserted);
+        auto base_deleted = positions(base.deleted);
+        auto now_inserted = strings(current->inserted);
+        auto now_deleted = positions(current->deleted);
+
+        // A string inserted before the merge and then deleted, or deleted before the merge and then inserted again,
+        // has a different state in merged than in the current strings
+        std::vector<std::string> inserted;
+        std::vector<std::string> deleted;
+        std::set_difference(now_inserted.begin(), now_inserted.end(), base_inserted.begin(), base_inserted.end(),
+                            std::back_inserter(inserted));
+        std::set_difference(base_inserted.begin(), base_inserted.end(), now_inserted.begin(), now_inserted.end(),
+                            std::back_inserter(deleted));
+        std::vector<size_t> reinserted;
+        std::vector<size_t> newly_deleted;
+        std::set_difference(base_deleted.begin(), base_deleted.end(), now_deleted.begin(), now_deleted.end(),
+                            std::back_inserter(reinserted));
+        std::set_difference(now_deleted.begin(), now_deleted.end(), base_deleted.begin(), base_deleted.end(),
+                            std::back_inserter(newly_deleted));
+        auto &frozen = *base.frozen;
+        std::vector<char> buffer(std::max(frozen.build_stats().max_length, merged->build_stats().max_length) + 1);
+        for (auto p: reinserted)
+            inserted.emplace_back(buffer.data(), frozen.access(p, buffer.data()) - 1);
+        for (auto p: newly_deleted)
+            deleted.emplace_back(buffer.data(), frozen.access(p, buffer.data()) - 1);
+        std::sort(inserted.begin(), inserted.end());
+
+        std::vector<Inserted> inserted_ranks;
+        std::vector<size_t> deleted_positions;
+        for (auto &s: inserted) {
+            auto rank = merged->rank(s);
+            inserted_ranks.push_back({std::move(s), rank});
+        }
+        for (auto &s: deleted)
+            deleted_positions.push_back(*merged->locate(s));
+        std::sort(deleted_positions.begin(), deleted_positions.end());
+        auto next = std::make_shared<Snapshot>(std::move(merged));
+        next->inserted = ChunkedVector<Inserted>(std::move(inserted_ranks));
+        next->deleted = ChunkedVector<size_t>(std::move(deleted_positions));
+        publish(std::move(next));
+    }
+
+public:
+
+    /**
+     * Creates a dictionary with the sorted strings in [first, last), whose frozen arrays are built with the given
+     * options. A merge starts when the delta holds merge_threshold changes: a larger one makes the merges rarer, but
+     * the queries slower, as they search the delta in addition to the frozen array.
+     */
+    template<typename InputIt>
+    DynamicRearCodedArray(InputIt first, InputIt last, const Options &options = {}, size_t merge_threshold = 1 << 14)
+        : options(options), merge_threshold(std::max<size_t>(1, merge_threshold)),
+          current(std::make_shared<const Snapshot>(std::make_shared<const Array>(first, last, options))) {}
+
+    /** Creates a dictionary with the strings of array, e.g. one obtained by Array::load(). */
+    explicit DynamicRearCodedArray(Array &&array, const Options &options = {}, size_t merge_threshold = 1 << 14)
+        : options(options), merge_threshold(std::max<size_t>(1, merge_threshold)),
+          current(std::make_shared<const Snapshot>(std::make_shared<const Array>(std::move(array)))) {}
+
+    DynamicRearCodedArray(const DynamicRearCodedArray &) = delete;
+    DynamicRearCodedArray &operator=(const DynamicRearCodedArray &) = delete;
+
+    /** Waits for the running merge, if any. Must not run concurrently with the other methods. */
+    ~DynamicRearCodedArray() {
+        if (merger.joinable())
+            merger.join();
+    }
+
+    /** Inserts s, and returns false if it was already in the dictionary. */
+    bool insert(std::string_view s) {
+        std::lock_guard update_lock(update_mutex);
+        rethrow_merge_error();
+        auto &now = *current;
+        if (auto p = now.frozen->locate(s)) {
+            auto k = now.deleted_lower_bound(*p);
+            if (k == now.deleted.size() || now.deleted[k] != *p)
+                return false;
+            auto next = std::make_shared<Snapshot>(now);
+            next->deleted.erase(k);
+            publish(std::move(next));
+        } else {
+            auto t = now.inserted_lower_bound(s);
+            if (t < now.inserted.size() && now.inserted[t].string == s)
+                return false;
+            auto next = std::make_shared<Snapshot>(now);
+            next->inserted.insert(t, {std::string(s), now.frozen->rank(s)});
+            publish(std::move(next));
+        }
+        maybe_merge();
+        return true;
+    }
+
+    /** Deletes s, and returns false if it was not in the dictionary. */
+    bool erase(std::string_view s) {
+        std::lock_guard update_lock(update_mutex);
+        rethrow_merge_error();
+        auto &now = *current;
+        auto t = now.inserted_lower_bound(s);
+        if (t < now.inserted.size() && now.inserted[t].string == s) {
+            auto next = std::make_shared<Snapshot>(now);
+            next->inserted.erase(t);
+            publish(std::move(next));
+        } else {
+            auto p = now.frozen->locate(s);
+            if (!p)
+                return false;
+            auto k = now.deleted_lower_bound(*p);
+            if (k < now.deleted.size() && now.deleted[k] == *p)
+                return false;
+            auto next = std::make_shared<Snapshot>(now);
+            next->deleted.insert(k, *p);
+            publish(std::move(next));
+        }
+        maybe_merge();
+        return true;
+    }
+
+    /**
+     * Waits for the running merge, if any, and rethrows the exception that made it fail, if any. Must not run
+     * concurrently with the updates.
+     */
+    void wait_for_merge() {
+        if (merger.joinable())
+            merger.join();
+        std::lock_guard update_lock(update_mutex);
+        rethrow_merge_error();
+    }
+
+    size_t size() const { return snapshot()->size(); }
+
+    /** Returns the number of changes in the delta, i.e. not yet merged into the frozen array. */
+    size_t delta_size() const {
+        auto state = snapshot();
+        return state->inserted.size() + state->deleted.size();
+    }
+
+    /** Returns the number of strings <= s. */
+    size_t rank(std::string_view s) const {
+        auto state = snapshot();
+        auto r = state->frozen->rank(s);
+        auto inserted_leq = state->inserted.partition_point([&](size_t, const Inserted &x) { return x.string <= s; });
+        return r - state->deleted_lower_bound(r) + inserted_leq;
+    }
+
+    /**
+     * Writes the string at position i to out, followed by a \0, and returns the end of what was written. As in
+     * Array::access, out must fit the strings that precede it in its block in the frozen array. Since the updates can
+     * run meanwhile, i must be below the size of the dictionary as seen by the caller, e.g. before its own updates.
+     */
+    char *access(size_t i, char *out) const {
+        auto state = snapshot();
+        auto t = state->inserted.partition_point([&](size_t t, const Inserted &x) {
+            return state->inserted_position(t, x.rank) < i;
+        });
+        if (t < state->inserted.size() && state->inserted_position(t, state->inserted[t].rank) == i) {
+            auto &s = state->inserted[t].string;
+            std::memcpy(out, s.data(), s.length());
+            out[s.length()] = '\0';
+            return out + s.length() + 1;
+        }
+        return state->frozen->access(state->frozen_position(i - t), out);
+    }
+
+    /** Calls f(std::string_view) on each string in order, as of the call, even if updates run meanwhile. */
+    template<typename F>
+    void for_each(F f) const {
+        auto state = snapshot();
+        for (UnionIterator it(*state->frozen, state->deleted, state->inserted); !it.done(); ++it)
+            f(*it);
+    }
+
+    /** Returns the memory taken by the frozen array and the delta, except a merge in progress. */
+    size_t size_in_bytes() const {
+        auto state = snapshot();
+        return state->frozen->size_in_bytes() + sizeof(*this) + sizeof(Snapshot)
+            + state->inserted.size_in_bytes([](const Inserted &x) { return sizeof(x) + x.string.capacity(); })
+            + state->deleted.size_in_bytes([](size_t) { return sizeof(size_t); });
+    }
+};
+
+}
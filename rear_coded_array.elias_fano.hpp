@@ -0,0 +1,232 @@
+//
+// Elias-Fano encoding of monotone sequences, used by the compact block directories of the RearCodedArray variants.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+#include "rear_coded_array.storage.hpp"
+
+namespace rca {
+
+/** The table of the positions of the ones in a byte, by rank and byte, for selecting in words without BMI2. */
+struct SelectInByte {
+    uint8_t table[8][256] = {};
+
+    constexpr SelectInByte() {
+        for (size_t byte = 0; byte < 256; ++byte)
+            for (size_t bit = 0, rank = 0; bit < 8; ++bit)
+                if (byte >> bit & 1)
+                    table[rank++][byte] = uint8_t(bit);
+    }
+
+    constexpr const uint8_t *operator[](size_t rank) const { return table[rank]; }
+};
+
+inline constexpr SelectInByte select_in_byte{};
+
+/**
+ * A non-decreasing sequence of integers in Elias-Fano form, which takes about 2 + log(max / size) bits per value. The
+ * low bits of each value are stored verbatim, the high bits in unary, and the positions of every 64th one and zero of
+ * the unary part are sampled, so that access and successor take constant time. Everything, including the parameters,
+ * lives in a single array of words, which can be saved and mapped as one section.
+ */
+class EliasFano {
+    static constexpr size_t sample_rate = 64;
+
+    enum Header : size_t { Size, Last, LowerBits, LowerWords, UpperWords, OnesSamples, ZerosSamples, HeaderWords };
+
+    Storage<std::vector<uint64_t>> words;
+    size_t n = 0;
+    size_t lower_bits = 0;
+    const uint64_t *lower = nullptr;
+    const uint64_t *upper = nullptr;
+    const uint64_t *ones = nullptr;  ///< Position in upper of the ones of rank 0, 64, 128, ...
+    const uint64_t *zeros = nullptr; ///< Position in upper of the zeros of rank 0, 64, 128, ...
+
+    void attach() {
+        n = words.empty() ? 0 : words[Size];
+        if (n == 0)
+            return;
+        lower_bits = words[LowerBits];
+        lower = words.data() + HeaderWords;
+        upper = lower + words[LowerWords];
+        ones = upper + words[UpperWords];
+        zeros = ones + words[OnesSamples];
+    }
+
+    static size_t popcount(uint64_t word) {
+#ifdef __POPCNT__
+        return __builtin_popcountll(word);
+#else
+        word -= word >> 1 & 0x5555555555555555ull;
+        word = (word & 0x3333333333333333ull) + (word >> 2 & 0x3333333333333333ull);
+        return ((word + (word >> 4)) & 0x0f0f0f0f0f0f0f0full) * 0x0101010101010101ull >> 56;
+#endif
+    }
+
+    /** Returns the position of the one of the given rank in word, via the broadword algorithm of Vigna if no BMI2. */
+    static size_t select_in_word(uint64_t word, size_t rank) {
+#ifdef __BMI2__
+        return __builtin_ctzll(_pdep_u64(uint64_t(1) << rank, word));
+#else
+        constexpr auto ones_step_8 = 0x0101010101010101ull;
+        constexpr auto msbs_step_8 = 0x8080808080808080ull;
+        auto bytes = word - (word >> 1 & 0x5555555555555555ull);
+        bytes = (bytes & 0x3333333333333333ull) + (bytes >> 2 & 0x3333333333333333ull);
+        auto byte_sums = ((bytes + (bytes >> 4)) & 0x0f0f0f0f0f0f0f0full) * ones_step_8; // Prefix sums of the bytes
+        auto bytes_leq_rank = ((rank * ones_step_8 | msbs_step_8) - byte_sums) & msbs_step_8;
+        auto place = (bytes_leq_rank >> 7) * ones_step_8 >> 53 & ~size_t(7);
+        rank -= (byte_sums << 8) >> place & 0xff;
+        return place + select_in_byte[rank][word >> place & 0xff];
+#endif
+    }
+
+    /** Returns the position in upper of the one (or zero, if Zeros) of the given rank. */
+    template<bool Zeros>
+    size_t select(size_t rank) const {
+        auto from = (Zeros ? zeros : ones)[rank / sample_rate];
+        rank %= sample_rate;
+        auto w = from / 64;
+        auto word = (Zeros ? ~upper[w] : upper[w]) & (~uint64_t(0) << from % 64);
+        for (size_t c; rank >= (c = popcount(word)); rank -= c)
+            word = Zeros ? ~upper[++w] : upper[++w];
+        return w * 64 + select_in_word(word, rank);
+    }
+
+    uint64_t low(size_t i) const {
+        if (lower_bits == 0)
+            return 0;
+        auto bit = i * lower_bits;
+        auto value = lower[bit / 64] >> bit % 64;
+        if (bit % 64 + lower_bits > 64)
+            value |= lower[bit / 64 + 1] << (64 - bit % 64);
+        return value & ((uint64_t(1) << lower_bits) - 1);
+    }
+
+public:
+
+    EliasFano() = default;
+
+    EliasFano(const EliasFano &other) : words(other.words) { attach(); }
+
+    EliasFano(EliasFano &&other) noexcept : words(std::move(other.words)) { attach(); }
+
+    EliasFano &operator=(EliasFano other) {
+        words = std::move(other.words);
+        attach();
+        return *this;
+    }
+
+    explicit EliasFano(const std::vector<uint64_t> &values)
+        : EliasFano(values.size(), values.empty() ? 0 : values.back(), [&](auto push) {
+        for (auto v: values)
+            push(v);
+    }) {}
+
+    /**
+     * Encodes the size values, none of which exceeds max_value, that for_each passes in non-decreasing order to the
+     * function it is given. This allows encoding a sequence that is not materialized, such as one read from a file.
+     */
+    template<typename ForEach>
+    EliasFano(size_t size, uint64_t max_value, ForEach for_each) {
+        if (size == 0)
+            return;
+        size_t lower_bits = max_value < size ? 0 : 63 - __builtin_clzll(max_value / size);
+        auto lower_words = (size * lower_bits + 63) / 64 + 1; // One more word, which the reads of two words may touch
+        auto upper_bits = size + (max_value >> lower_bits) + 1;
+        auto upper_words = (upper_bits + 63) / 64;
+        auto zeros_count = upper_bits - size;
+        auto ones_samples = (size + sample_rate - 1) / sample_rate;
+        auto zeros_samples = (zeros_count + sample_rate - 1) / sample_rate;
+        std::vector<uint64_t> words(HeaderWords + lower_words + upper_words + ones_samples + zeros_samples);
+        words[Size] = size;
+        words[LowerBits] = lower_bits;
+        words[LowerWords] = lower_words;
+        words[UpperWords] = upper_words;
+        words[OnesSamples] = ones_samples;
+        words[ZerosSamples] = zeros_samples;
+
+        auto lower = words.data() + HeaderWords;
+        auto upper = lower + lower_words;
+        size_t i = 0;
+        uint64_t prev = 0;
+        for_each([&](uint64_t v) {
+            if (i == size || v < prev || v > max_value)
+                throw std::invalid_argument("the sequence is not non-decreasing or exceeds its size or maximum");
+            if (lower_bits > 0) {
+                auto bit = i * lower_bits;
+                auto value = v & ((uint64_t(1) << lower_bits) - 1);
+                lower[bit / 64] |= value << bit % 64;
+                if (bit % 64 + lower_bits > 64)
+                    lower[bit / 64 + 1] |= value >> (64 - bit % 64);
+            }
+            auto pos = (v >> lower_bits) + i;
+            upper[pos / 64] |= uint64_t(1) << pos % 64;
+            prev = v;
+            ++i;
+        });
+        if (i != size)
+            throw std::invalid_argument("the sequence is shorter than its size");
+        words[Last] = prev;
+
+        uint64_t *samples[2] = {upper + upper_words + ones_samples, upper + upper_words}; // Of the zeros and ones
+        size_t seen[2] = {0, 0};
+        for (size_t pos = 0; pos < upper_bits; ++pos) {
+            auto bit = upper[pos / 64] >> pos % 64 & 1;
+            if (seen[bit] % sample_rate == 0)
+                samples[bit][seen[bit] / sample_rate] = pos;
+            ++seen[bit];
+        }
+
+        this->words = std::move(words);
+        attach();
+    }
+
+    /** Views a sequence saved as the words returned by storage(), throwing std::runtime_error if they are malformed. */
+    explicit EliasFano(Storage<std::vector<uint64_t>> words) : words(std::move(words)) {
+        auto &w = this->words;
+        if (!w.empty() && (w.size() < HeaderWords || w[LowerBits] > 63 || w.size() != HeaderWords + w[LowerWords]
+            + w[UpperWords] + w[OnesSamples] + w[ZerosSamples]))
+            throw std::runtime_error("malformed Elias-Fano sequence");
+        attach();
+    }
+
+    size_t size() const { return n; }
+
+    bool empty() const { return n == 0; }
+
+    size_t size_in_bytes() const { return bits_size_in_bytes() + sizeof(*this); }
+
+    /** Returns the bytes of the encoded sequence only, for owners whose own size already counts this object. */
+    size_t bits_size_in_bytes() const { return words.size() * sizeof(uint64_t); }
+
+    /** Returns the words to be saved in a section, from which the sequence can be mapped back. */
+    const Storage<std::vector<uint64_t>> &storage() const { return words; }
+
+    uint64_t operator[](size_t i) const { return uint64_t(select<false>(i) - i) << lower_bits | low(i); }
+
+    uint64_t back() const { return words[Last]; }
+
+    /** Returns the index of the first value >= x, or size() if there is none. */
+    size_t successor(uint64_t x) const {
+        if (n == 0 || x > back())
+            return n;
+        auto high = x >> lower_bits;
+        auto pos = high == 0 ? 0 : select<true>(high - 1) + 1; // The first bit of the values sharing the high bits of x
+        auto i = pos - high;
+        for (auto x_low = x & ((uint64_t(1) << lower_bits) - 1); upper[pos / 64] >> pos % 64 & 1; ++pos, ++i)
+            if (low(i) >= x_low)
+                return i;
+        return i;
+    }
+};
+
+}
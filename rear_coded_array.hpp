@@ -7,42 +7,52 @@
 #include <algorithm>
 #include <cassert>
 #include <cstring>
-#include <iostream>
+#include <fstream>
+#include <iterator>
 #include <limits>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "rear_coded_array.block_cache.hpp"
+#include "rear_coded_array.elias_fano.hpp"
+#include "rear_coded_array.simd.hpp"
+#include "rear_coded_array.stats.hpp"
+#include "rear_coded_array.storage.hpp"
+
+/**
+ * A rear-coded array whose headers start their blocks, and whose block directory stores counts and pointers as values
+ * of the unsigned type Offset, which bounds the number of strings and the bytes of data that the array can hold.
+ */
+template<typename Offset>
+class BasicInlineRearCodedArray {
+    static_assert(std::is_unsigned_v<Offset>, "Offset must be an unsigned integer type");
 
-size_t compute_lcp(const char *a, const char *b) {
-    size_t i = 0;
-    while (a[i] != '\0' && a[i] == b[i])
-        ++i;
-    return i;
-}
-
-size_t compute_lcp(std::string_view a, std::string_view b) {
-    return std::mismatch(a.begin(), a.end(), b.begin(), b.end()).first - a.begin();
-}
-
-class RearCodedArray {
     class HeaderIterator;
 
-    std::string data;
-    std::vector<size_t> pointers; // TODO: Interleave pointers and counts
-    std::vector<uint32_t> counts;
+    rca::Storage<std::string> data;
+    rca::Storage<std::vector<Offset>> pointers; // TODO: Interleave pointers and counts
+    rca::Storage<std::vector<Offset>> counts;
+    rca::EliasFano compact_pointers; ///< The pointers as an Elias-Fano sequence, if they and counts are empty
+    rca::EliasFano compact_counts;   ///< The counts as an Elias-Fano sequence, if they and pointers are empty
+    size_t block_bytes;
     size_t n;
-    char *buffer;
+    rca::BuildStats stats; ///< The statistics of the input, see build_stats()
+
+    BasicInlineRearCodedArray() : block_bytes(0), n(0) {}
 
 public:
 
+    /** If compact_directory, the pointers and counts of the blocks are stored as Elias-Fano sequences. */
     template<typename InputIt>
-    RearCodedArray(InputIt first, InputIt last, size_t block_bytes) : n(0) {
+    BasicInlineRearCodedArray(InputIt first, InputIt last, size_t block_bytes, bool compact_directory = false)
+        : block_bytes(block_bytes), n(0) {
+        std::string data;
+        std::vector<Offset> pointers;
+        std::vector<Offset> counts;
         data.reserve(1 << 20);
-        size_t input_bytes = 0;
-        size_t max_length = 0;
-        size_t max_lcp = 0;
-        size_t sum_lcp = 0;
-        size_t sum_length = 0;
         std::string prev;
 
         for (n = 0; first != last; ++n, ++first) {
@@ -50,18 +60,17 @@ public:
                 throw std::invalid_argument("data is not sorted");
 
             auto lcp = compute_lcp(prev, *first);
-            max_lcp = std::max(max_lcp, lcp);
-            max_length = std::max(max_length, first->length());
-            sum_lcp += lcp;
-            sum_length += first->length();
-            input_bytes += first->length() + 1;
+            stats.max_lcp = std::max<size_t>(stats.max_lcp, lcp);
+            stats.max_length = std::max<size_t>(stats.max_length, first->length());
+            stats.sum_lcp += lcp;
+            stats.input_bytes += first->length() + 1;
 
             auto current_block_bytes = n == 0 ? std::numeric_limits<size_t>::max() : data.size() - pointers.back();
             if (current_block_bytes >= block_bytes) {
-                pointers.push_back(data.size());
+                pointers.push_back(Offset(data.size()));
                 data.append(*first);
                 data.push_back('\0');
-                counts.push_back(n);
+                counts.push_back(Offset(n));
                 prev = *first;
                 continue;
             }
@@ -73,114 +82,315 @@ public:
             prev = *first;
         }
 
-        counts.push_back(n);
+        if (n > std::numeric_limits<Offset>::max() || data.size() > std::numeric_limits<Offset>::max())
+            throw std::length_error("the array exceeds the range of its block directory offsets");
+        counts.push_back(Offset(n));
+        data.append(rca::simd_padding, '\0');
         data.shrink_to_fit();
         pointers.shrink_to_fit();
         counts.shrink_to_fit();
-        buffer = new char[max_length]();
 
-        size_t max_hdr_lcp = 0;
-        size_t sum_hdr_lcp = 0;
         for (size_t i = 1; i < pointers.size(); ++i) {
             auto lcp = compute_lcp(data.data() + pointers[i], data.data() + pointers[i - 1]);
-            max_hdr_lcp = std::max(max_hdr_lcp, lcp);
-            sum_hdr_lcp += lcp;
+            stats.max_header_lcp = std::max<size_t>(stats.max_header_lcp, lcp);
+            stats.sum_header_lcp += lcp;
         }
 
-        std::cout << "Input bytes             " << input_bytes << std::endl
-                  << "Input avg length        " << sum_length / double(n) << std::endl
-                  << "Input avg LCP           " << sum_lcp / double(n) << ", max " << max_lcp << std::endl
-                  << "RC block_bytes          " << block_bytes << std::endl
-                  << "RC bytes                " << size_in_bytes() << std::endl
-                  << "RC blocks               " << pointers.size() << std::endl
-                  << "RC headers avg LCP      " << sum_hdr_lcp / double(pointers.size())
-                  << ", max " << max_hdr_lcp << std::endl
-                  << "Avg strings per block   " << n / pointers.size() << std::endl;
+        this->data = std::move(data);
+        if (compact_directory) {
+            compact_pointers = rca::EliasFano(std::vector<uint64_t>(pointers.begin(), pointers.end()));
+            compact_counts = rca::EliasFano(std::vector<uint64_t>(counts.begin(), counts.end()));
+        } else {
+            this->pointers = std::move(pointers);
+            this->counts = std::move(counts);
+        }
     }
 
-    ~RearCodedArray() { delete buffer; }
+    size_t size() const { return n; }
+
+    size_t blocks_count() const { return counts.empty() ? compact_pointers.size() : pointers.size(); }
 
     size_t size_in_bytes() const {
         return data.size() * sizeof(data[0]) + pointers.size() * sizeof(pointers[0]) + sizeof(*this)
-            + counts.size() * sizeof(counts[0]);
+            + counts.size() * sizeof(counts[0]) + compact_pointers.bits_size_in_bytes()
+            + compact_counts.bits_size_in_bytes();
+    }
+
+    /**
+     * Returns the statistics on the input and the layout of the array. Those on the input are gathered while building
+     * it and saved along with it, so they are available after load() too.
+     */
+    rca::BuildStats build_stats() const {
+        auto result = stats;
+        result.strings = n;
+        result.block_bytes = block_bytes;
+        result.blocks = blocks_count();
+        result.bytes = size_in_bytes();
+        return result;
+    }
+
+    /** Writes the array to out in the format that load() maps in memory. */
+    void save(std::ostream &out) const {
+        rca::Writer writer(out, rca::Layout::InlineHeaders);
+        writer.param(n);
+        writer.param(block_bytes);
+        writer.param(sizeof(Offset));
+        writer.section(data);
+        writer.section(pointers);
+        writer.section(counts);
+        writer.section(compact_pointers.storage());
+        writer.section(compact_counts.storage());
+        for (auto field: rca::build_stats_input_fields)
+            writer.param(stats.*field);
+        writer.finish();
+    }
+
+    void save(const std::string &path) const {
+        std::ofstream out(path, std::ios::binary);
+        save(out);
+    }
+
+    /**
+     * Maps in memory an array written by save(). Queries read the mapped bytes directly, so loading takes constant
+     * time and processes loading the same file share its pages. The checksums of the sections are verified only on
+     * request, since that reads the whole file.
+     */
+    static BasicInlineRearCodedArray load(const std::string &path, bool verify_checksums = false) {
+        rca::MappedFile file(path, rca::Layout::InlineHeaders, verify_checksums);
+        auto stats_params = std::size(rca::build_stats_input_fields);
+        if (file.params_count() != 3 + stats_params || file.sections_count() != 5 || file.param(2) != sizeof(Offset))
+            throw std::runtime_error(path + ": incompatible RearCodedArray parameters");
+
+        BasicInlineRearCodedArray result;
+        result.n = file.param(0);
+        result.block_bytes = file.param(1);
+        for (size_t k = 0; k < stats_params; ++k)
+            result.stats.*rca::build_stats_input_fields[k] = file.param(3 + k);
+        result.data = file.section<std::string>(0);
+        result.pointers = file.section<std::vector<Offset>>(1);
+        result.counts = file.section<std::vector<Offset>>(2);
+        result.compact_pointers = rca::EliasFano(file.section<std::vector<uint64_t>>(3));
+        result.compact_counts = rca::EliasFano(file.section<std::vector<uint64_t>>(4));
+        auto directory_ok = result.counts.empty()
+            ? result.pointers.empty() && !result.compact_counts.empty() && result.compact_counts.back() == result.n
+                && result.compact_counts.size() == result.compact_pointers.size() + 1
+            : result.counts.size() == result.pointers.size() + 1 && result.counts.back() == result.n
+                && result.compact_counts.empty();
+        if (!directory_ok)
+            throw std::runtime_error(path + ": inconsistent block directory");
+        if (!rca::padded(result.data.data(), result.data.size()))
+            throw std::runtime_error(path + ": missing padding");
+        return result;
     }
 
     char *access(size_t i, char *out) const {
+        RCA_LATENCY(access_ns);
         auto block = block_containing_position(i);
-        auto data_ptr = data.data() + pointers[block];
+        auto data_ptr = data.data() + pointer_at(block);
         auto out_ptr = stpcpy(out, data_ptr);
         data_ptr += out_ptr - out + 1;
-        for (int j = 1; j <= i - counts[block]; ++j) {
+        for (size_t j = 1; j <= i - count_at(block); ++j) {
+            RCA_COUNT(strings_decoded, 1);
             auto rear_length = decode_int(data_ptr);
             out_ptr -= rear_length;
             auto tmp = stpcpy(out_ptr, data_ptr);
+            RCA_COUNT(bytes_decoded, tmp - out_ptr);
             data_ptr += tmp - out_ptr + 1;
             out_ptr = tmp;
         }
         return out_ptr + 1;
     }
 
+    /**
+     * Like access(i, out), but copies the string from the decoded blocks in the cache, where its block is decoded on a
+     * miss. The cache must be used with this array only.
+     */
+    char *access(size_t i, char *out, rca::BlockCache &cache) const {
+        RCA_LATENCY(access_ns);
+        auto block = block_containing_position(i);
+        auto decode = [this, block](std::string &bytes, std::vector<size_t> &offsets) {
+            decode_block(block, bytes, offsets);
+        };
+        return cache.visit(block, i - count_at(block), decode, [out](std::string_view s) {
+            std::memcpy(out, s.data(), s.length());
+            out[s.length()] = '\0';
+            return out + s.length() + 1;
+        });
+    }
+
     size_t rank(std::string_view s) const {
+        RCA_LATENCY(rank_ns);
         auto block = block_containing_string(s);
-        return counts[block] + block_rank(s, block);
+        return count_at(block) + block_rank(s, block);
     }
 
     size_t rank(std::string_view s, size_t block) const {
-        return counts[block] + block_rank(s, block);
+        return count_at(block) + block_rank(s, block);
     }
 
-    HeaderIterator headers_begin() const { return {data.data(), 0, pointers.data()}; }
-    HeaderIterator headers_end() const { return {data.data(), pointers.size(), pointers.data()}; }
+    /**
+     * Writes to out the rank of each string in [first, last), which must be sorted. Consecutive queries reuse the
+     * block of the previous answer: the header search gallops forward from it, and queries landing in the same block
+     * resume the decoding from the last string that was not greater than the previous query.
+     */
+    template<typename InputIt, typename OutputIt>
+    OutputIt rank_batch(InputIt first, InputIt last, OutputIt out) const {
+        if (n == 0) {
+            for (; first != last; ++first)
+                *out++ = 0;
+            return out;
+        }
+        if (first == last)
+            return out;
+
+        auto blocks = blocks_count();
+        size_t block = block_containing_string(*first);
+        size_t j = 0;                    // Position in the block of current
+        std::string current;             // Last decoded string in the block, which is <= the previous query
+        const char *data_ptr = nullptr;  // The entry of the string following current in the block
+        auto reset = [&] {
+            j = 0;
+            current = data.data() + pointer_at(block);
+            data_ptr = data.data() + pointer_at(block) + current.length() + 1;
+        };
+        reset();
+
+        for (; first != last; ++first, ++out) {
+            std::string_view pattern = *first;
+            auto header_leq = [&](size_t b) { return std::strcmp(pattern.data(), data.data() + pointer_at(b)) >= 0; };
+            if (block + 1 < blocks && header_leq(block + 1)) {
+                size_t lo = block + 1;
+                size_t step = 1;
+                while (lo + step < blocks && header_leq(lo + step)) {
+                    lo += step;
+                    step *= 2;
+                }
+                block = block_containing_string(pattern, lo, std::min(lo + step, blocks));
+                reset();
+            }
+
+            auto pattern_lcp = compute_lcp(pattern, current);
+            if (uint8_t(pattern[pattern_lcp]) < uint8_t(current[pattern_lcp])) {
+                *out = count_at(block) + j;
+                continue;
+            }
+
+            auto strings_in_block = count_at(block + 1) - count_at(block);
+            for (; j + 1 < strings_in_block; ++j) {
+                auto next_ptr = data_ptr;
+                auto prev_string_lcp = current.length() - decode_int(next_ptr);
+                if (prev_string_lcp < pattern_lcp)
+                    break;
+
+                if (prev_string_lcp == pattern_lcp) {
+                    auto lcp = lcp64(pattern.data() + pattern_lcp, pattern.length() - pattern_lcp, next_ptr);
+                    if (uint8_t(pattern[pattern_lcp + lcp]) < uint8_t(next_ptr[lcp]))
+                        break;
+                    pattern_lcp += lcp;
+                }
+
+                auto suffix_len = rca::string_length(next_ptr);
+                current.resize(prev_string_lcp);
+                current.append(next_ptr, suffix_len);
+                data_ptr = next_ptr + suffix_len + 1;
+            }
+
+            *out = count_at(block) + j + 1;
+        }
+
+        return out;
+    }
+
+    HeaderIterator headers_begin() const { return {this, 0}; }
+    HeaderIterator headers_end() const { return {this, blocks_count()}; }
 
 private:
 
     size_t block_containing_position(size_t i) const {
+        if (counts.empty())
+            return compact_counts.successor(i + 1) - 1;
         auto it = std::prev(std::upper_bound(counts.begin(), counts.end(), i));
         return std::distance(counts.begin(), it);
     }
 
-    size_t block_containing_string(std::string_view s) const {
-        size_t lo = 0;
-        size_t hi = pointers.size();
+    /** Appends the strings of the block to bytes, each followed by a \0, and the offset of each of them to offsets. */
+    void decode_block(size_t block, std::string &bytes, std::vector<size_t> &offsets) const {
+        auto data_ptr = data.data() + pointer_at(block);
+        std::string current(data_ptr);
+        data_ptr += current.length() + 1;
+        auto strings = (block + 1 < blocks_count() ? count_at(block + 1) : n) - count_at(block);
+        offsets.reserve(strings);
+        for (size_t j = 0;; ++j) {
+            offsets.push_back(bytes.length());
+            bytes.append(current.c_str(), current.length() + 1);
+            if (j + 1 == strings)
+                break;
+            current.resize(current.length() - decode_int(data_ptr));
+            auto suffix_len = rca::string_length(data_ptr);
+            current.append(data_ptr, suffix_len);
+            data_ptr += suffix_len + 1;
+        }
+    }
+
+    size_t pointer_at(size_t block) const { return counts.empty() ? compact_pointers[block] : pointers[block]; }
+
+    size_t count_at(size_t block) const { return counts.empty() ? compact_counts[block] : counts[block]; }
+
+    size_t block_containing_string(std::string_view s) const { return block_containing_string(s, 0, blocks_count()); }
+
+    /** Returns the last block in [lo, hi) whose header is <= s, or lo if there is none. */
+    size_t block_containing_string(std::string_view s, size_t lo, size_t hi) const {
+        auto first = lo;
         size_t count = hi - lo;
         while (count > 0) {
             auto step = count / 2;
             auto i = lo + step;
-            if (std::strcmp(s.data(), data.data() + pointers[i]) >= 0) {
+            RCA_COUNT(header_comparisons, 1);
+            if (std::strcmp(s.data(), data.data() + pointer_at(i)) >= 0) {
                 lo = i + 1;
                 count -= step + 1;
             } else
                 count = step;
         }
-        return lo - (lo != 0);
+        return lo - (lo != first);
     }
 
-    size_t block_rank(std::string_view pattern, size_t block) const {
-        assert(block < pointers.size());
-        auto data_ptr = data.data() + pointers[block];
-        auto buffer_end = stpcpy(buffer, data_ptr); // points to the \0 of the decoded string
-        data_ptr += buffer_end - buffer + 1;
-        auto pattern_lcp = compute_lcp(pattern.data(), buffer); // LCP b/w current string and pattern
+    static size_t lcp64(const char *s1, size_t len1, const char *s2) { return rca::mismatch(s1, s2, len1); }
 
-        if (pattern[pattern_lcp] < buffer[pattern_lcp])
+    size_t block_rank(std::string_view pattern, size_t block) const {
+        assert(block < blocks_count());
+        auto header_ptr = data.data() + pointer_at(block);
+        auto pattern_lcp = lcp64(pattern.data(), pattern.length(), header_ptr); // LCP b/w current string and pattern
+        if (uint8_t(pattern[pattern_lcp]) < uint8_t(header_ptr[pattern_lcp])) {
+            RCA_COUNT(early_exits, 1);
             return 0;
+        }
 
-        auto strings_in_block = counts[block + 1] - counts[block];
-        for (int j = 1; j < strings_in_block; ++j) {
+        auto curr_length = pattern_lcp + rca::string_length(header_ptr + pattern_lcp); // Length of the current string
+        auto data_ptr = header_ptr + curr_length + 1;
+        auto strings_in_block = count_at(block + 1) - count_at(block);
+        for (size_t j = 1; j < strings_in_block; ++j) {
+            RCA_COUNT(strings_decoded, 1);
             auto rear_length = decode_int(data_ptr);
-            auto prev_string_lcp = buffer_end - buffer - rear_length; // LCP b/w curr and previous string in the block
-            if (prev_string_lcp < pattern_lcp)
+            auto prev_string_lcp = curr_length - rear_length; // LCP b/w curr and previous string in the block
+            if (prev_string_lcp < pattern_lcp) {
+                RCA_COUNT(early_exits, 1);
                 return j;
+            }
 
-            buffer_end -= rear_length;
-            auto tmp = stpcpy(buffer_end, data_ptr);
-            data_ptr += tmp - buffer_end + 1;
-            buffer_end = tmp;
             if (prev_string_lcp == pattern_lcp) {
-                pattern_lcp += compute_lcp(pattern.data() + prev_string_lcp, buffer + prev_string_lcp);
-                if (pattern[pattern_lcp] < buffer[pattern_lcp])
+                auto lcp = lcp64(pattern.data() + prev_string_lcp, pattern.length() - prev_string_lcp, data_ptr);
+                pattern_lcp += lcp;
+                if (uint8_t(pattern[pattern_lcp]) < uint8_t(data_ptr[lcp])) {
+                    RCA_COUNT(early_exits, 1);
                     return j;
+                }
             }
+
+            auto suffix_len = rca::string_length(data_ptr);
+            RCA_COUNT(bytes_decoded, suffix_len);
+            data_ptr += suffix_len + 1;
+            curr_length = prev_string_lcp + suffix_len;
         }
 
         return strings_in_block;
@@ -216,9 +426,8 @@ private:
     }
 
     class HeaderIterator {
-        const char *ptr;
+        const BasicInlineRearCodedArray *rca;
         size_t block;
-        const size_t *pointers;
 
     public:
         using iterator_category = std::random_access_iterator_tag;
@@ -227,12 +436,11 @@ private:
         using pointer = value_type *;
         using reference = const value_type &;
 
-        HeaderIterator(const char *ptr, size_t block, const size_t *pointers)
-            : ptr(ptr), block(block), pointers(pointers) {}
+        HeaderIterator(const BasicInlineRearCodedArray *rca, size_t block) : rca(rca), block(block) {}
 
-        value_type operator*() const { return ptr + pointers[block]; }
+        value_type operator*() const { return rca->data.data() + rca->pointer_at(block); }
 
-        value_type operator[](difference_type off) const { return ptr + pointers[block + off]; }
+        value_type operator[](difference_type off) const { return rca->data.data() + rca->pointer_at(block + off); }
 
         HeaderIterator &operator++() {
             ++block;
@@ -242,7 +450,7 @@ private:
         HeaderIterator operator++(int) {
             auto b = block;
             ++*this;
-            return HeaderIterator(ptr, b, pointers);
+            return HeaderIterator(rca, b);
         }
 
         HeaderIterator &operator--() {
@@ -253,7 +461,7 @@ private:
         HeaderIterator operator--(int) {
             auto b = block;
             --*this;
-            return HeaderIterator(ptr, b, pointers);
+            return HeaderIterator(rca, b);
         }
 
         HeaderIterator &operator+=(difference_type off) {
@@ -261,14 +469,14 @@ private:
             return *this;
         }
 
-        HeaderIterator operator+(difference_type off) const { return HeaderIterator(ptr, block + off, pointers); }
+        HeaderIterator operator+(difference_type off) const { return HeaderIterator(rca, block + off); }
 
         HeaderIterator &operator-=(difference_type off) {
             block -= off;
             return *this;
         }
 
-        HeaderIterator operator-(difference_type off) const { return HeaderIterator(ptr, block - off, pointers); }
+        HeaderIterator operator-(difference_type off) const { return HeaderIterator(rca, block - off); }
 
         difference_type operator-(const HeaderIterator &right) const { return difference_type(block - right.block); }
 
@@ -279,4 +487,10 @@ private:
         bool operator>(const HeaderIterator &r) const { return block > r.block; }
         bool operator>=(const HeaderIterator &r) const { return block >= r.block; }
     };
-};
\ No newline at end of file
+};
+
+/** The default array with inline headers, whose block directory fits up to 4 GiB of data and 2^32 strings. */
+using InlineRearCodedArray = BasicInlineRearCodedArray<uint32_t>;
+
+/** An array with inline headers and 64-bit counts and pointers, for dictionaries exceeding InlineRearCodedArray. */
+using InlineRearCodedArray64 = BasicInlineRearCodedArray<uint64_t>;
@@ -0,0 +1,236 @@
+//
+// An order-0 Huffman code on bytes with table-driven decoding, for the suffixes of the RearCodedArray blocks.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rca {
+
+/** The frequencies of the bytes at the start of a stream, up to about sample_bytes, on which a code is built. */
+class ByteHistogram {
+    std::array<uint64_t, 256> counts{};
+    size_t bytes = 0;
+
+public:
+
+    static constexpr size_t sample_bytes = 1 << 20;
+
+    /** Counts the bytes of s, which makes the sample full if they reach sample_bytes. */
+    void add(std::string_view s) {
+        for (auto c: s)
+            ++counts[uint8_t(c)];
+        bytes += s.size();
+    }
+
+    bool full() const { return bytes >= sample_bytes; }
+
+    uint64_t operator[](size_t symbol) const { return counts[symbol]; }
+};
+
+/**
+ * A canonical Huffman code on bytes whose codewords are at most max_length bits long, so that the symbols are decoded
+ * by a lookup of the next max_length bits in a table of 2^max_length entries, which gives the first two symbols when
+ * both codewords fit in those bits. Every byte has a codeword, so that the bytes missing from the sample that the code
+ * is built on can be encoded too.
+ */
+class HuffmanCode {
+    struct Entry {
+        uint8_t symbols[2];
+        uint8_t first_length; ///< Length of the codeword of the first symbol
+        uint8_t length;       ///< Length of the codewords of both symbols, or of the first only if it is the same
+    };
+
+public:
+
+    static constexpr size_t max_length = 12;
+
+private:
+
+    std::array<uint8_t, 256> lengths{};
+    std::array<uint16_t, 256> codes{};
+    std::array<Entry, size_t(1) << max_length> table{};
+
+    void assign_codes() {
+        size_t kraft = 0;
+        size_t length_counts[max_length + 1] = {};
+        for (auto l: lengths) {
+            if (l == 0 || l > max_length)
+                throw std::invalid_argument("invalid Huffman code length");
+            kraft += size_t(1) << (max_length - l);
+            ++length_counts[l];
+        }
+        if (kraft > table.size())
+            throw std::invalid_argument("Huffman code lengths not satisfying the Kraft inequality");
+
+        uint16_t next_code[max_length + 1] = {};
+        uint16_t code = 0;
+        for (size_t l = 1; l <= max_length; ++l) {
+            code = uint16_t((code + length_counts[l - 1]) << 1);
+            next_code[l] = code;
+        }
+        // The entries of no codeword are unused if the code is complete, as the ones built from frequencies
+        table.fill({{0, 0}, max_length, max_length});
+        for (size_t s = 0; s < 256; ++s) {
+            codes[s] = next_code[lengths[s]]++;
+            auto first = size_t(codes[s]) << (max_length - lengths[s]);
+            Entry entry{{uint8_t(s), 0}, lengths[s], lengths[s]};
+            std::fill_n(table.begin() + first, size_t(1) << (max_length - lengths[s]), entry);
+        }
+
+        // The bits after the first codeword start the second one, whose entry is therefore already known
+        auto single = table;
+        for (size_t i = 0; i < table.size(); ++i) {
+            auto &second = single[(i << table[i].first_length) & (table.size() - 1)];
+            if (table[i].first_length + second.first_length <= max_length) {
+                table[i].symbols[1] = second.symbols[0];
+                table[i].length = uint8_t(table[i].first_length + second.first_length);
+            }
+        }
+    }
+
+public:
+
+    /** Builds a code on the frequencies of the bytes in the sample, each increased by one. */
+    explicit HuffmanCode(const ByteHistogram &sample) {
+        struct Node {
+            uint64_t weight;
+            size_t id;
+            bool operator>(const Node &other) const {
+                return weight > other.weight || (weight == other.weight && id > other.id);
+            }
+        };
+        std::priority_queue<Node, std::vector<Node>, std::greater<>> queue;
+        std::vector<size_t> parent(511);
+        for (size_t s = 0; s < 256; ++s)
+            queue.push({sample[s] + 1, s});
+        for (auto id = size_t(256); queue.size() > 1; ++id) {
+            auto a = queue.top();
+            queue.pop();
+            auto b = queue.top();
+            queue.pop();
+            parent[a.id] = parent[b.id] = id;
+            queue.push({a.weight + b.weight, id});
+        }
+        std::vector<size_t> depth(511);
+        for (auto id = size_t(509); id < 510; --id)
+            depth[id] = depth[parent[id]] + 1;
+
+        // Limit the lengths, then lengthen the longest codewords that are still shorter than the limit, which are of
+        // the rarest symbols, until the code is prefix-free again
+        size_t kraft = 0;
+        for (size_t s = 0; s < 256; ++s) {
+            lengths[s] = uint8_t(std::min(depth[s], max_length));
+            kraft += size_t(1) << (max_length - lengths[s]);
+        }
+        while (kraft > table.size()) {
+            size_t longest = 0;
+            for (size_t s = 0; s < 256; ++s)
+                if (lengths[s] < max_length && (lengths[longest] == max_length || lengths[s] > lengths[longest]
+                    || (lengths[s] == lengths[longest] && sample[s] < sample[longest])))
+                    longest = s;
+            ++lengths[longest];
+            kraft -= size_t(1) << (max_length - lengths[longest]);
+        }
+        assign_codes();
+    }
+
+    /** Rebuilds the code with the given lengths of the codewords of the 256 bytes, e.g. read from a file. */
+    explicit HuffmanCode(const uint8_t *code_lengths) {
+        std::copy_n(code_lengths, lengths.size(), lengths.begin());
+        assign_codes();
+    }
+
+    /** Returns the lengths of the codewords of the 256 bytes, which are all that is needed to rebuild the code. */
+    const std::array<uint8_t, 256> &code_lengths() const { return lengths; }
+
+    /** Appends to out the codewords of the bytes of s, then zero bits up to the next byte boundary. */
+    void encode(std::string_view s, std::string &out) const {
+        uint64_t buffer = 0;
+        size_t bits = 0;
+        for (auto c: s) {
+            buffer = buffer << lengths[uint8_t(c)] | codes[uint8_t(c)];
+            bits += lengths[uint8_t(c)];
+            while (bits >= 8) {
+                bits -= 8;
+                out.push_back(char(buffer >> bits));
+            }
+        }
+        if (bits > 0)
+            out.push_back(char(buffer << (8 - bits)));
+    }
+
+    /**
+     * Decodes the bytes encoded from a given position, in consecutive pieces of any size, so that a reader can stop as
+     * soon as it has the bytes it needs. It reads 8 bytes at a time, so the encoded bytes must be padded.
+     */
+    class Decoder {
+        const HuffmanCode *code;
+        const char *in;
+        uint64_t buffer = 0; ///< The next bits, from the most significant one
+        size_t bits = 0;
+
+    public:
+
+        Decoder(const HuffmanCode &code, const char *in) : code(&code), in(in) {}
+
+        /** Decodes the next count bytes, and writes them to out. */
+        void decode(size_t count, char *out) {
+            // On copies of the state, which the stores to out could otherwise alias
+            auto in = this->in;
+            auto buffer = this->buffer;
+            auto bits = this->bits;
+            auto &table = code->table;
+            auto refill = [&] {
+                // With whole bytes, so that in stays byte-aligned
+                uint64_t word;
+                std::memcpy(&word, in, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                word = __builtin_bswap64(word);
+#endif
+                auto bytes = (63 - bits) / 8;
+                buffer |= word >> bits & ~(~uint64_t(0) >> (bits + 8 * bytes));
+                in += bytes;
+                bits += 8 * bytes;
+            };
+
+            // Both symbols of an entry are written, and the second is overwritten next if it was not decoded
+            auto end = out + count;
+            while (end - out >= 2) {
+                if (bits < max_length)
+                    refill();
+                auto &entry = table[buffer >> (64 - max_length)];
+                out[0] = char(entry.symbols[0]);
+                out[1] = char(entry.symbols[1]);
+                out += 1 + (entry.length > entry.first_length);
+                buffer <<= entry.length;
+                bits -= entry.length;
+            }
+            if (out != end) {
+                if (bits < max_length)
+                    refill();
+                auto &entry = table[buffer >> (64 - max_length)];
+                *out = char(entry.symbols[0]);
+                buffer <<= entry.first_length;
+                bits -= entry.first_length;
+            }
+            this->in = in;
+            this->buffer = buffer;
+            this->bits = bits;
+        }
+    };
+
+    /** Decodes the first count bytes encoded in, and writes them to out. As Decoder, in must be padded. */
+    void decode(const char *in, size_t count, char *out) const { Decoder(*this, in).decode(count, out); }
+};
+
+}
@@ -0,0 +1,116 @@
+//
+// Streaming union of RearCodedArrays, with the mapping of the positions of each input to those of the result.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <string_view>
+#include <vector>
+
+#include "rear_coded_array.separate_headers.hpp"
+
+namespace rca {
+
+/**
+ * An input iterator over the distinct strings of several arrays, in order, which decodes each array sequentially and
+ * keeps only the current string of each. As it advances past a string, it appends the position of the string in the
+ * union to remaps[i] for each input i that contains it, so that remaps[i][j] ends up being the position of the j-th
+ * string of inputs[i].
+ */
+template<typename Array>
+class MergeIterator {
+    std::vector<typename Array::iterator> heads;
+    std::vector<typename Array::iterator> ends;
+    std::vector<size_t> heap; ///< The inputs not yet exhausted, by their current string and then by their index
+    std::vector<std::vector<size_t>> *remaps = nullptr;
+    size_t position = 0;
+
+    bool after(size_t a, size_t b) const {
+        auto c = (*heads[a]).compare(*heads[b]);
+        return c > 0 || (c == 0 && a > b);
+    }
+
+    size_t pop() {
+        std::pop_heap(heap.begin(), heap.end(), [&](auto a, auto b) { return after(a, b); });
+        auto i = heap.back();
+        heap.pop_back();
+        return i;
+    }
+
+    /** Moves input i, which is not in the heap, past its current string, whose position in the union is position. */
+    void advance(size_t i) {
+        (*remaps)[i].push_back(position);
+        if (++heads[i] == ends[i])
+            return;
+        heap.push_back(i);
+        std::push_heap(heap.begin(), heap.end(), [&](auto a, auto b) { return after(a, b); });
+    }
+
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string_view *;
+    using reference = std::string_view;
+
+    /** Returns an iterator past the end of any union. */
+    MergeIterator() = default;
+
+    MergeIterator(const std::vector<const Array *> &inputs, std::vector<std::vector<size_t>> &remaps)
+        : remaps(&remaps) {
+        remaps.assign(inputs.size(), {});
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            remaps[i].reserve(inputs[i]->size());
+            heads.push_back(inputs[i]->begin());
+            ends.push_back(inputs[i]->end());
+            if (heads[i] != ends[i])
+                heap.push_back(i);
+        }
+        std::make_heap(heap.begin(), heap.end(), [&](auto a, auto b) { return after(a, b); });
+    }
+
+    bool done() const { return heap.empty(); }
+
+    /** The returned view is invalidated when the iterator is moved. */
+    std::string_view operator*() const { return *heads[heap.front()]; }
+
+    MergeIterator &operator++() {
+        auto top = pop();
+        // The other inputs holding the same string are now at the top of the heap
+        while (!heap.empty() && *heads[heap.front()] == *heads[top])
+            advance(pop());
+        advance(top);
+        ++position;
+        return *this;
+    }
+
+    /** Compares equal to another iterator only if both are done or neither is, which suffices for a single pass. */
+    bool operator==(const MergeIterator &other) const { return done() == other.done(); }
+    bool operator!=(const MergeIterator &other) const { return !(*this == other); }
+};
+
+/**
+ * Returns an array with the distinct strings of the given arrays, which are decoded and rear-coded again in a single
+ * sequential pass, without sorting nor materializing the strings. Sets remaps[i][j] to the position in the result of
+ * the j-th string of inputs[i].
+ */
+template<typename Array>
+Array merge(const std::vector<const Array *> &inputs, std::vector<std::vector<size_t>> &remaps,
+            const typename Array::Options &options = {}) {
+    return Array(MergeIterator<Array>(inputs, remaps), MergeIterator<Array>(), options);
+}
+
+/**
+ * Pushes the distinct strings of the given arrays to builder, e.g. to write a union larger than memory, and sets
+ * remaps as merge() does. The builder is not finished, so that more strings can follow.
+ */
+template<typename Array>
+void merge(const std::vector<const Array *> &inputs, typename Array::Builder &builder,
+           std::vector<std::vector<size_t>> &remaps) {
+    for (MergeIterator<Array> it(inputs, remaps); !it.done(); ++it)
+        builder.push_back(*it);
+}
+
+}
@@ -0,0 +1,52 @@
+//
+// Compile-time selection of a RearCodedArray variant, so that the variants can be instantiated side by side.
+//
+
+#pragma once
+
+#include <cstdint>
+
+#include "rear_coded_array.hpp"
+#include "rear_coded_array.separate_headers.hpp"
+
+namespace rca {
+
+/** Where the headers of the blocks are stored. */
+enum class HeaderPlacement {
+    Inline,   ///< At the start of their blocks, as in rear_coded_array.hpp
+    Separate, ///< Contiguously, apart from the rear-coded data, as in rear_coded_array.separate_headers.hpp
+};
+
+/**
+ * The compile-time choices that define a rear-coded array: the placement of the headers, the codec of the rear lengths
+ * and the unsigned type of the offsets of the block directory. The inline headers support the varint codec only.
+ */
+template<HeaderPlacement Headers, RearLengthCodec Codec = RearLengthCodec::Varint, typename Offset = uint32_t>
+struct ArrayPolicy {
+    static constexpr HeaderPlacement headers = Headers;
+    static constexpr RearLengthCodec codec = Codec;
+    using offset_type = Offset;
+};
+
+template<typename Policy, HeaderPlacement = Policy::headers>
+struct PolicyArraySelector;
+
+template<typename Policy>
+struct PolicyArraySelector<Policy, HeaderPlacement::Inline> {
+    static_assert(Policy::codec == RearLengthCodec::Varint, "inline headers support the varint rear lengths only");
+    using type = BasicInlineRearCodedArray<typename Policy::offset_type>;
+};
+
+template<typename Policy>
+struct PolicyArraySelector<Policy, HeaderPlacement::Separate> {
+    using type = BasicRearCodedArray<typename Policy::offset_type, Policy::codec>;
+};
+
+/**
+ * The array defined by an ArrayPolicy. All of them can be built with (first, last, block_bytes), and answer rank(),
+ * access() and size_in_bytes().
+ */
+template<typename Policy>
+using PolicyArray = typename PolicyArraySelector<Policy>::type;
+
+}
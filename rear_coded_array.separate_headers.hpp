@@ -6,150 +6,732 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <cstdio>
 #include <cstring>
-#include <iostream>
+#include <exception>
+#include <fstream>
+#include <iterator>
 #include <limits>
+#include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
-size_t compute_lcp(const char *a, const char *b) {
-    size_t i = 0;
-    while (a[i] != '\0' && a[i] == b[i])
-        ++i;
-    return i;
-}
+#include "rear_coded_array.block_cache.hpp"
+#include "rear_coded_array.elias_fano.hpp"
+#include "rear_coded_array.huffman.hpp"
+#include "rear_coded_array.simd.hpp"
+#include "rear_coded_array.stats.hpp"
+#include "rear_coded_array.storage.hpp"
+
+namespace rca {
+
+/** How the rear lengths of the strings in a block are encoded, which is the layout of the block. */
+enum class RearLengthCodec {
+    Runtime, ///< Chosen when building the array by Options::split_streams, and tested for each string read
+    Varint,  ///< Each as a varint before the suffix of its string, i.e., the classic layout
+    Split,   ///< Each as a byte, or an escape and a varint, before all the suffixes, i.e., the split layout
+};
 
-size_t compute_lcp(std::string_view a, std::string_view b) {
-    return std::mismatch(a.begin(), a.end(), b.begin(), b.end()).first - a.begin();
 }
 
-class RearCodedArray {
+/**
+ * A rear-coded array whose block directory stores counts and offsets as values of the unsigned type Offset, which
+ * bounds the number of strings and the bytes of rear-coded data and headers that the array can hold. If Codec fixes
+ * the layout of the blocks, the loops that read them are compiled for that layout only.
+ */
+template<typename Offset, rca::RearLengthCodec Codec = rca::RearLengthCodec::Runtime>
+class BasicRearCodedArray {
+    static_assert(std::is_unsigned_v<Offset>, "Offset must be an unsigned integer type");
+
     class HeaderIterator;
     class BlockInfo;
+    struct IndexSlot;
+    template<rca::RearLengthCodec Layout>
+    class BasicBlockReader;
+    using BlockReader = BasicBlockReader<Codec>;
+    using HeaderGroupReader = BasicBlockReader<rca::RearLengthCodec::Varint>; ///< Groups are in the classic layout
+    class Cursor;
+    class StringIterator;
 
-    std::string data;
-    std::string headers;
-    std::vector<BlockInfo> info;
+    rca::Storage<std::string> data;
+    rca::Storage<std::string> headers;
+    rca::Storage<std::vector<BlockInfo>> info;  ///< Block directory, empty if it is stored in the compact form below
+    rca::EliasFano counts;                      ///< BlockInfo::count of the compact directory
+    rca::EliasFano data_pointers;               ///< BlockInfo::data_pointer of the compact directory
+    rca::EliasFano header_pointers;             ///< BlockInfo::header_pointer of the compact directory
+    rca::Storage<std::vector<uint64_t>> filter; ///< Blocked Bloom filter on the strings, empty if disabled
+    rca::Storage<std::vector<IndexSlot>> index; ///< Eytzinger header index from slot 1, empty if disabled
+    rca::Storage<std::vector<Offset>> position_samples; ///< Blocks of every 2^position_shift-th position and the last
+    size_t index_skip;                          ///< Length of the prefix shared by all headers
+    size_t position_shift;
+    size_t header_group;                        ///< Headers per group, whose first one only is stored in full
+    size_t filter_hashes;
+    bool split_streams;                         ///< Whether the blocks are in the split layout, see BlockReader
+    std::shared_ptr<const rca::HuffmanCode> huffman; ///< The code of the suffix bytes, or null if they are plain
+    size_t block_bytes;
     size_t n;
-    char *buffer;
+    rca::BuildStats stats;                      ///< The statistics of the input, see build_stats()
+
+    BasicRearCodedArray()
+        : index_skip(0), position_shift(0), header_group(1), filter_hashes(0), split_streams(false), block_bytes(0),
+          n(0) {}
 
 public:
 
-    template<typename InputIt>
-    RearCodedArray(InputIt first, InputIt last, size_t block_bytes) : n(0) {
-        data.reserve(1 << 22);
-        headers.reserve(1 << 20);
-        size_t input_bytes = 0;
-        size_t max_length = 0;
-        size_t max_lcp = 0;
-        size_t sum_lcp = 0;
-        size_t sum_length = 0;
-        std::string prev;
+    using iterator = StringIterator;
+    using const_iterator = StringIterator;
 
-        for (n = 0; first != last; ++n, ++first) {
-            if (*first <= prev)
-                throw std::invalid_argument("data is not sorted");
+    class Builder;
 
-            auto lcp = compute_lcp(prev, *first);
-            max_lcp = std::max(max_lcp, lcp);
-            max_length = std::max(max_length, first->length());
-            sum_lcp += lcp;
-            sum_length += first->length();
-            input_bytes += first->length() + 1;
+    struct Options {
+        size_t block_bytes = 128;       ///< Bytes of rear-coded data after which a new block is started
+        size_t filter_bits_per_key = 0; ///< Bits per string of the Bloom filter used by locate, 0 to disable it
+        size_t threads = 1;             ///< Threads encoding a random-access input, each one a chunk of whole blocks
+        bool header_index = false;      ///< Whether to search the headers via an Eytzinger index of their prefixes
+        size_t header_group = 1;        ///< Headers per group, rear-coded after the first one, 1 to store all in full
+        bool compact_directory = false; ///< Whether to store the block directory as Elias-Fano sequences
+        bool position_samples = false;  ///< Whether to sample the blocks of the positions, ignored if compact
+        bool split_streams = false;     ///< Whether to store the lengths of the strings of a block before their bytes,
+                                        ///< ignored if Codec fixes the layout
+        bool huffman_suffixes = false;  ///< Whether to Huffman-code the suffix bytes of the blocks, see BlockReader
+    };
 
-            auto current_block_bytes = n == 0 ? size_t(-1) : data.size() - info.back().data_pointer;
-            if (current_block_bytes >= block_bytes) {
-                info.emplace_back(n, data.size(), headers.size());
-                headers.append(*first);
-                headers.push_back('\0');
-                prev = *first;
-                continue;
+    template<typename InputIt>
+    BasicRearCodedArray(InputIt first, InputIt last, size_t block_bytes)
+        : BasicRearCodedArray(first, last, Options{block_bytes}) {}
+
+    template<typename InputIt>
+    BasicRearCodedArray(InputIt first, InputIt last, const Options &options)
+        : index_skip(0), position_shift(0), header_group(1), filter_hashes(0),
+          split_streams(split_layout(options.split_streams)), block_bytes(options.block_bytes), n(0) {
+        std::vector<Encoder> chunks;
+        using category = typename std::iterator_traits<InputIt>::iterator_category;
+        if constexpr (std::is_base_of_v<std::random_access_iterator_tag, category>) {
+            auto size = size_t(std::distance(first, last));
+            auto threads = std::clamp<size_t>(size / min_strings_per_thread, 1, std::max<size_t>(1, options.threads));
+            auto chunk_begin = [&](size_t t) { return first + size * t / threads; };
+            chunks.assign(threads, Encoder(options));
+            std::vector<std::exception_ptr> errors(threads);
+            std::vector<std::thread> workers;
+            auto encode = [&](size_t t) {
+                try {
+                    for (auto it = chunk_begin(t); it != chunk_begin(t + 1); ++it)
+                        chunks[t].push_back(*it);
+                    chunks[t].finish();
+                } catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            };
+            for (size_t t = 1; t < threads; ++t)
+                workers.emplace_back(encode, t);
+            encode(0);
+            for (auto &w: workers)
+                w.join();
+            for (auto &e: errors)
+                if (e)
+                    std::rethrow_exception(e);
+            for (size_t t = 1; t < threads; ++t) {
+                std::string_view prev = *(chunk_begin(t) - 1);
+                std::string_view curr = *chunk_begin(t);
+                if (curr <= prev)
+                    throw std::invalid_argument("data is not sorted");
+                auto lcp = compute_lcp(prev, curr);
+                chunks[t].max_lcp = std::max(chunks[t].max_lcp, lcp);
+                chunks[t].sum_lcp += lcp;
             }
+        } else {
+            chunks.emplace_back(options);
+            for (; first != last; ++first)
+                chunks[0].push_back(*first);
+            chunks[0].finish();
+        }
+
+        size_t data_bytes = 0;
+        size_t headers_bytes = 0;
+        size_t blocks = 0;
+        for (auto &c: chunks) {
+            stats.input_bytes += c.input_bytes;
+            stats.max_length = std::max<size_t>(stats.max_length, c.max_length);
+            stats.max_lcp = std::max<size_t>(stats.max_lcp, c.max_lcp);
+            stats.sum_lcp += c.sum_lcp;
+            data_bytes += c.data.size();
+            headers_bytes += c.headers.size();
+            blocks += c.info.size();
+        }
 
-            auto rear_length = prev.length() - lcp;
-            encode_int(rear_length, data);
-            data.append(*first, lcp);
-            data.push_back('\0');
-            prev = *first;
+        std::string data;
+        std::string headers;
+        std::vector<BlockInfo> info;
+        std::vector<uint64_t> hashes;
+        if (chunks.size() == 1) {
+            data = std::move(chunks[0].data);
+            headers = std::move(chunks[0].headers);
+            info = std::move(chunks[0].info);
+            hashes = std::move(chunks[0].hashes);
+            n = chunks[0].n;
+        } else {
+            data.reserve(data_bytes + rca::simd_padding);
+            headers.reserve(headers_bytes + rca::simd_padding);
+            info.reserve(blocks + 1);
+            for (auto &c: chunks) {
+                for (auto &b: c.info)
+                    info.emplace_back(n + b.count, data.size() + b.data_pointer, headers.size() + b.header_pointer);
+                n += c.n;
+                data.append(c.data);
+                headers.append(c.headers);
+                hashes.insert(hashes.end(), c.hashes.begin(), c.hashes.end());
+                c = Encoder(options);
+            }
         }
 
-        headers.append('\0', sizeof(uint64_t));
+        if (options.huffman_suffixes)
+            huffman_code_blocks(data, info);
+        data.append(rca::simd_padding, '\0');
+        headers.append(rca::simd_padding, '\0');
         info.emplace_back(n, data.size(), headers.size());
         info.shrink_to_fit();
         data.shrink_to_fit();
         headers.shrink_to_fit();
-        buffer = new char[max_length]();
+        this->data = std::move(data);
+        this->headers = std::move(headers);
+        this->info = std::move(info);
+        if (!hashes.empty())
+            build_filter(hashes, options.filter_bits_per_key);
+        if (options.header_index && blocks_count() > 0)
+            index = header_index(blocks_count(), [&](size_t b) { return plain_header(b); }, index_skip);
+        if (options.position_samples && !options.compact_directory && n > 0) {
+            position_shift = position_samples_shift(n, blocks_count());
+            std::vector<Offset> samples;
+            for (size_t b = 0; b < blocks_count(); ++b)
+                append_position_samples(b, count_at(b), count_at(b + 1), position_shift, samples);
+            samples.push_back(blocks_count() - 1);
+            position_samples = std::move(samples);
+        }
 
-        size_t max_hdr_lcp = 0;
-        size_t sum_hdr_lcp = 0;
-        for (auto it = headers_begin() + 1; it != headers_end(); ++it) {
+        for (auto it = headers_begin() + 1; it < headers_end(); ++it) {
             auto lcp = compute_lcp(*it, *(it - 1));
-            max_hdr_lcp = std::max(max_hdr_lcp, lcp);
-            sum_hdr_lcp += lcp;
+            stats.max_header_lcp = std::max<size_t>(stats.max_header_lcp, lcp);
+            stats.sum_header_lcp += lcp;
         }
 
-        std::cout << "Input bytes             " << input_bytes << std::endl
-                  << "Input avg length        " << sum_length / double(n) << std::endl
-                  << "Input avg LCP           " << sum_lcp / double(n) << ", max " << max_lcp << std::endl
-                  << "RC block_bytes          " << block_bytes << std::endl
-                  << "RC bytes                " << size_in_bytes() << std::endl
-                  << "RC blocks               " << blocks_count() << std::endl
-                  << "RC headers avg LCP      " << sum_hdr_lcp / double(blocks_count())
-                  << ", max " << max_hdr_lcp << std::endl
-                  << "Avg strings per block   " << n / blocks_count() << std::endl;
+        if (options.header_group > 1)
+            group_headers(options.header_group);
+        if (options.compact_directory)
+            compact_directory();
     }
 
-    ~RearCodedArray() { delete buffer; }
+    size_t size() const { return n; }
 
-    size_t blocks_count() const { return info.size() - 1; }
+    size_t blocks_count() const { return (info.empty() ? counts.size() : info.size()) - 1; }
 
     size_t size_in_bytes() const {
         return data.size() * sizeof(data[0]) + headers.size() * sizeof(headers[0])
             + info.size() * sizeof(info[0])
+            + counts.bits_size_in_bytes() + data_pointers.bits_size_in_bytes() + header_pointers.bits_size_in_bytes()
+            + filter.size() * sizeof(filter[0])
+            + index.size() * sizeof(index[0])
+            + position_samples.size() * sizeof(position_samples[0])
+            + (huffman ? sizeof(rca::HuffmanCode) : 0)
             + sizeof(*this);
     }
 
+    /**
+     * Returns the statistics on the input and the layout of the array. Those on the input are gathered while building
+     * it and saved along with it, so they are available after load() too.
+     */
+    rca::BuildStats build_stats() const {
+        auto result = stats;
+        result.strings = n;
+        result.block_bytes = block_bytes;
+        result.blocks = blocks_count();
+        result.bytes = size_in_bytes();
+        result.filter_bytes = filter.size() * sizeof(filter[0]);
+        return result;
+    }
+
+    /** Writes the array to out in the format that load() maps in memory. */
+    void save(std::ostream &out) const {
+        rca::Writer writer(out, rca::Layout::SeparateHeaders);
+        writer.param(n);
+        writer.param(block_bytes);
+        writer.param(filter_hashes);
+        writer.param(sizeof(BlockInfo));
+        writer.param(index_skip);
+        writer.param(header_group);
+        writer.section(data);
+        writer.section(headers);
+        writer.section(info);
+        writer.section(filter);
+        writer.section(index);
+        writer.section(counts.storage());
+        writer.section(data_pointers.storage());
+        writer.section(header_pointers.storage());
+        writer.section(position_samples);
+        writer.section(huffman ? std::string_view(reinterpret_cast<const char *>(huffman->code_lengths().data()), 256)
+                               : std::string_view());
+        writer.param(position_shift);
+        writer.param(split_streams);
+        for (auto field: rca::build_stats_input_fields)
+            writer.param(stats.*field);
+        writer.finish();
+    }
+
+    void save(const std::string &path) const {
+        std::ofstream out(path, std::ios::binary);
+        save(out);
+    }
+
+    /**
+     * Maps in memory an array written by save(). Queries read the mapped bytes directly, so loading takes constant
+     * time and processes loading the same file share its pages. The checksums of the sections are verified only on
+     * request, since that reads the whole file.
+     */
+    static BasicRearCodedArray load(const std::string &path, bool verify_checksums = false) {
+        rca::MappedFile file(path, rca::Layout::SeparateHeaders, verify_checksums);
+        auto stats_params = std::size(rca::build_stats_input_fields);
+        if (file.params_count() != 8 + stats_params || file.sections_count() != 10 || file.param(3) != sizeof(BlockInfo)
+            || file.param(7) > 1 || split_layout(file.param(7)) != bool(file.param(7)))
+            throw std::runtime_error(path + ": incompatible RearCodedArray parameters");
+
+        BasicRearCodedArray result;
+        result.n = file.param(0);
+        result.block_bytes = file.param(1);
+        result.filter_hashes = file.param(2);
+        result.index_skip = file.param(4);
+        result.header_group = file.param(5);
+        result.position_shift = file.param(6);
+        result.split_streams = file.param(7);
+        for (size_t k = 0; k < stats_params; ++k)
+            result.stats.*rca::build_stats_input_fields[k] = file.param(8 + k);
+        result.data = file.section<std::string>(0);
+        result.headers = file.section<std::string>(1);
+        result.info = file.section<std::vector<BlockInfo>>(2);
+        result.filter = file.section<std::vector<uint64_t>>(3);
+        result.index = file.section<std::vector<IndexSlot>>(4);
+        result.counts = rca::EliasFano(file.section<std::vector<uint64_t>>(5));
+        result.data_pointers = rca::EliasFano(file.section<std::vector<uint64_t>>(6));
+        result.header_pointers = rca::EliasFano(file.section<std::vector<uint64_t>>(7));
+        result.position_samples = file.section<std::vector<Offset>>(8);
+        auto code_lengths = file.section<std::string>(9);
+        if (code_lengths.size() != 0 && code_lengths.size() != 256)
+            throw std::runtime_error(path + ": inconsistent Huffman code");
+        if (code_lengths.size() == 256) {
+            try {
+                result.huffman = std::make_shared<const rca::HuffmanCode>(
+                    reinterpret_cast<const uint8_t *>(code_lengths.data()));
+            } catch (const std::invalid_argument &e) {
+                throw std::runtime_error(path + ": " + e.what());
+            }
+        }
+        auto directory_ok = result.info.empty()
+            ? !result.counts.empty() && result.counts.back() == result.n
+                && result.data_pointers.size() == result.counts.size()
+                && result.header_pointers.size() == result.counts.size()
+            : result.info.back().count == result.n && result.counts.empty();
+        if (!directory_ok || result.header_group == 0)
+            throw std::runtime_error(path + ": inconsistent block directory");
+        if (!rca::padded(result.data.data(), result.data.size())
+            || !rca::padded(result.headers.data(), result.headers.size()))
+            throw std::runtime_error(path + ": missing padding");
+        if (!result.index.empty() && result.index.size() != result.blocks_count() + 1)
+            throw std::runtime_error(path + ": inconsistent header index");
+        if (!result.position_samples.empty() && (result.info.empty() || result.position_shift >= 64
+            || result.position_samples.size() != ((result.n - 1) >> result.position_shift) + 2
+            || result.position_samples.back() != result.blocks_count() - 1))
+            throw std::runtime_error(path + ": inconsistent position samples");
+        return result;
+    }
+
     char *access(size_t i, char *out) const {
+        RCA_LATENCY(access_ns);
         auto block = block_containing_position(i);
-        auto out_ptr = stpcpy(out, headers.data() + info[block].header_pointer);
-        auto data_ptr = data.data() + info[block].data_pointer;
-        for (int j = 1; j <= i - info[block].count; ++j) {
-            auto rear_length = decode_int(data_ptr);
-            out_ptr -= rear_length;
-            auto tmp = stpcpy(out_ptr, data_ptr);
-            data_ptr += tmp - out_ptr + 1;
-            out_ptr = tmp;
+        auto &scratch = header_buffer();
+        auto out_ptr = stpcpy(out, header(block, scratch));
+        auto reader = block_reader(block);
+        for (auto j = count_at(block); j < i; ++j) {
+            RCA_COUNT(strings_decoded, 1);
+            out_ptr -= reader.rear_length();
+            auto suffix_len = reader.suffix_length();
+            std::memcpy(out_ptr, reader.suffix(), suffix_len);
+            out_ptr += suffix_len;
+            reader.skip(suffix_len);
         }
+        *out_ptr = '\0';
         return out_ptr + 1;
     }
 
+    /**
+     * Like access(i, out), but copies the string from the decoded blocks in the cache, where its block is decoded on a
+     * miss. The cache must be used with this array only.
+     */
+    char *access(size_t i, char *out, rca::BlockCache &cache) const {
+        RCA_LATENCY(access_ns);
+        auto block = block_containing_position(i);
+        auto decode = [this, block](std::string &bytes, std::vector<size_t> &offsets) {
+            decode_block(block, bytes, offsets);
+        };
+        return cache.visit(block, i - count_at(block), decode, [out](std::string_view s) {
+            std::memcpy(out, s.data(), s.length());
+            out[s.length()] = '\0';
+            return out + s.length() + 1;
+        });
+    }
+
     size_t rank(std::string_view s) const {
-        auto block = block_containing_string(s);
-        return info[block].count + block_rank(s, block);
+        RCA_LATENCY(rank_ns);
+        if (n == 0)
+            return 0;
+        auto [block, header_ptr] = block_and_header_containing_string(s);
+        return count_at(block) + rear_coded_search(s, header_ptr, block).first;
     }
 
     size_t rank(std::string_view s, size_t block) const {
-        return info[block].count + block_rank(s, block);
+        return count_at(block) + block_rank(s, block);
+    }
+
+    /**
+     * Returns the position of s, or std::nullopt if s is not in the array. The answer comes from a single decoding
+     * of the block, and most of the strings not in the array are rejected by the filter, if any, before searching.
+     */
+    std::optional<size_t> locate(std::string_view s) const {
+        if (n == 0)
+            return std::nullopt;
+        if (!filter.empty() && !filter_may_contain(hash(s))) {
+            RCA_COUNT(filter_rejections, 1);
+            return std::nullopt;
+        }
+        auto [block, header_ptr] = block_and_header_containing_string(s);
+        auto [rank_in_block, found] = rear_coded_search(s, header_ptr, block);
+        if (!found)
+            return std::nullopt;
+        return count_at(block) + rank_in_block - 1;
+    }
+
+    /**
+     * Writes to out the rank of each string in [first, last), which must be sorted. Consecutive queries reuse the
+     * block of the previous answer: the header search gallops forward from it, and queries landing in the same block
+     * resume the decoding from the last string that was not greater than the previous query.
+     */
+    template<typename InputIt, typename OutputIt>
+    OutputIt rank_batch(InputIt first, InputIt last, OutputIt out) const {
+        if (n == 0) {
+            for (; first != last; ++first)
+                *out++ = 0;
+            return out;
+        }
+        if (first == last)
+            return out;
+
+        auto blocks = blocks_count();
+        size_t block = block_containing_string(*first);
+        size_t j = 0;                          // Position in the block of current
+        std::string current;                   // Last decoded string in the block, which is <= the previous query
+        BlockReader reader(nullptr, 0, false); // Reads the string following current in the block
+        auto &scratch = header_buffer();
+        auto reset = [&] {
+            j = 0;
+            decode_header(block, current);
+            reader = block_reader(block);
+        };
+        reset();
+
+        for (; first != last; ++first, ++out) {
+            std::string_view pattern = *first;
+            auto header_leq = [&](size_t b) {
+                return strcmp_lcp(pattern.data(), pattern.length(), header(b, scratch)).first >= 0;
+            };
+            if (block + 1 < blocks && header_leq(block + 1)) {
+                size_t lo = block + 1;
+                size_t step = 1;
+                while (lo + step < blocks && header_leq(lo + step)) {
+                    lo += step;
+                    step *= 2;
+                }
+                block = block_containing_string(pattern, lo, std::min(lo + step, blocks));
+                reset();
+            }
+
+            auto pattern_lcp = compute_lcp(pattern, current);
+            if (uint8_t(pattern[pattern_lcp]) < uint8_t(current[pattern_lcp])) {
+                *out = count_at(block) + j;
+                continue;
+            }
+
+            auto strings_in_block = count_at(block + 1) - count_at(block);
+            for (; j + 1 < strings_in_block; ++j) {
+                auto next = reader;
+                auto suffix_to_remove = next.rear_length();
+                auto prev_string_lcp = current.length() - suffix_to_remove;
+                if (prev_string_lcp < pattern_lcp)
+                    break;
+
+                auto suffix_len = next.suffix_length();
+                if (prev_string_lcp == pattern_lcp) {
+                    auto lcp = lcp64(pattern.data() + pattern_lcp, std::min(pattern.length() - pattern_lcp, suffix_len),
+                                     next.suffix());
+                    if (suffix_greater(pattern, pattern_lcp, next.suffix(), suffix_len, lcp))
+                        break;
+                    pattern_lcp += lcp;
+                }
+
+                current.resize(prev_string_lcp);
+                current.append(next.suffix(), suffix_len);
+                next.skip(suffix_len);
+                reader = next;
+            }
+
+            *out = count_at(block) + j + 1;
+        }
+
+        return out;
     }
 
-    HeaderIterator headers_begin() const { return {headers.data(), 0, info.data()}; }
-    HeaderIterator headers_end() const { return {headers.data(), blocks_count(), info.data()}; }
+    /**
+     * Writes to out[k] the rank of the k-th string in [first, last), which need not be sorted. Up to interleaved_lanes
+     * queries are in flight: each one in turn takes a step of its search and prefetches what the next step reads, so
+     * that the cache misses of the queries overlap instead of adding up. The interleaving applies to the headers stored
+     * in full and searched without the index in the plain directory, otherwise the queries are answered one at a time.
+     * It pays off when the headers are much larger than the cache, and is slower than rank() when they fit in it.
+     */
+    template<typename ForwardIt, typename RandomIt>
+    void rank_interleaved(ForwardIt first, ForwardIt last, RandomIt out) const {
+        if (header_group > 1 || !index.empty() || info.empty() || n == 0) {
+            for (; first != last; ++first, ++out)
+                *out = rank(*first);
+            return;
+        }
+
+        RankLane lanes[interleaved_lanes];
+        size_t next_query = 0;
+        for (auto busy = true; busy;) {
+            busy = false;
+            for (auto &lane: lanes) {
+                if (lane.stage == RankLane::Idle && first != last)
+                    lane.start(*first++, next_query++, this);
+                busy |= lane.stage != RankLane::Idle;
+                if (lane.stage != RankLane::Idle)
+                    lane.advance(this, out);
+            }
+        }
+    }
+
+    /**
+     * Returns the range [lo, hi) of positions of the strings that start with prefix, which can be streamed with
+     * access_range(lo, hi, f) or iterator_at(lo). One search on the headers finds the blocks of both boundaries: it
+     * forks only after reaching a header that extends the prefix.
+     */
+    std::pair<size_t, size_t> prefix_range(std::string_view prefix) const {
+        if (n == 0)
+            return {0, 0};
+        auto [lo_block, hi_block] = blocks_containing_prefix(prefix);
+        auto [lo, hi] = block_prefix_rank(prefix, lo_block);
+        if (hi_block != lo_block)
+            hi = block_prefix_rank(prefix, hi_block).second;
+        return {count_at(lo_block) + lo, count_at(hi_block) + hi};
+    }
+
+    /**
+     * Calls f(std::string_view) on the string at each position in [first, last), which must be sorted. Each block
+     * containing some of the positions is decoded once, from its header up to the last position requested in it.
+     */
+    template<typename InputIt, typename F>
+    void access_batch(InputIt first, InputIt last, F f) const {
+        Cursor cursor(this);
+        for (; first != last; ++first) {
+            cursor.seek(*first);
+            f(std::string_view(cursor.current));
+        }
+    }
+
+    /**
+     * Appends the strings at the positions in the sorted range [first, last) to bytes, each followed by a \0, and
+     * the offset in bytes where each of them starts to offsets.
+     */
+    template<typename InputIt>
+    void access_batch(InputIt first, InputIt last, std::string &bytes, std::vector<size_t> &offsets) const {
+        access_batch(first, last, ArenaAppender{bytes, offsets});
+    }
+
+    /** Calls f(std::string_view) on the strings at positions [i, j) in a single sequential pass. */
+    template<typename F>
+    void access_range(size_t i, size_t j, F f) const {
+        Cursor cursor(this);
+        for (cursor.seek(i), j = std::min(j, n); i < j; ++i, cursor.next())
+            f(std::string_view(cursor.current));
+    }
+
+    /** Like access_range(i, j, f), but writes the strings into the bytes/offsets arena as access_batch does. */
+    void access_range(size_t i, size_t j, std::string &bytes, std::vector<size_t> &offsets) const {
+        access_range(i, j, ArenaAppender{bytes, offsets});
+    }
+
+    /** Returns an iterator to the string at position i, which decodes the following strings sequentially. */
+    StringIterator iterator_at(size_t i) const { return {this, i}; }
+    StringIterator begin() const { return {this, 0}; }
+    StringIterator end() const { return {this, n}; }
+
+    HeaderIterator headers_begin() const { return {this, 0}; }
+    HeaderIterator headers_end() const { return {this, blocks_count()}; }
 
 private:
 
-    size_t block_containing_position(size_t i) const {
-        auto it = std::upper_bound(info.begin(), info.end(), i, [](auto &a, auto &b) { return a < b.count; });
+    /** Returns the header of the block, which is decoded into scratch unless it is stored in full. */
+    const char *header(size_t block, std::string &scratch) const {
+        if (header_group == 1 || block % header_group == 0)
+            return plain_header(block);
+        decode_header(block, scratch);
+        scratch.reserve(scratch.length() + rca::simd_padding); // The vectorized comparisons may read past the end
+        return scratch.c_str();
+    }
+
+    /** Appends the strings of the block to bytes, each followed by a \0, and the offset of each of them to offsets. */
+    void decode_block(size_t block, std::string &bytes, std::vector<size_t> &offsets) const {
+        auto &scratch = header_buffer();
+        std::string current = header(block, scratch);
+        auto reader = block_reader(block);
+        auto strings = count_at(block + 1) - count_at(block);
+        offsets.reserve(strings);
+        for (size_t j = 0;; ++j) {
+            offsets.push_back(bytes.length());
+            bytes.append(current.c_str(), current.length() + 1);
+            if (j + 1 == strings)
+                break;
+            current.resize(current.length() - reader.rear_length());
+            auto suffix_len = reader.suffix_length();
+            current.append(reader.suffix(), suffix_len);
+            reader.skip(suffix_len);
+        }
+    }
+
+    /** Returns the buffer of the calling thread for decoding headers, which queries reuse to avoid allocations. */
+    static std::string &header_buffer() {
+        thread_local std::string buffer;
+        return buffer;
+    }
+
+    /** Assigns to out the header of the block, decoding it from the first header of its group. */
+    void decode_header(size_t block, std::string &out) const {
+        auto first = block - block % header_group;
+        out = plain_header(first);
+        auto entry_ptr = plain_header(first) + out.length() + 1;
+        for (auto b = first; b < block; ++b) {
+            auto suffix_to_remove = decode_int(entry_ptr);
+            auto suffix_len = rca::string_length(entry_ptr);
+            out.resize(out.length() - suffix_to_remove);
+            out.append(entry_ptr, suffix_len);
+            entry_ptr += suffix_len + 1;
+        }
+    }
+
+    /** Returns the header of a block that is stored in full, i.e. the first of its group. */
+    const char *plain_header(size_t block) const { return headers.data() + header_pointer_at(block); }
+
+    /**
+     * Rear-codes each header but the first of every group of the given size w.r.t. the previous header, in the same
+     * way as the strings in a block.
+     */
+    void group_headers(size_t group) {
+        std::string grouped;
+        std::vector<BlockInfo> grouped_info(info.begin(), info.end());
+        std::string_view prev;
+        for (size_t b = 0; b < blocks_count(); ++b) {
+            std::string_view h = plain_header(b);
+            grouped_info[b].header_pointer = grouped.size(); // Cannot exceed the original header_pointer
+            append_header(prev, h, b % group == 0, grouped);
+            prev = h;
+        }
+        grouped.append(rca::simd_padding, '\0');
+        grouped_info.back() = BlockInfo(n, data.size(), grouped.size());
+        grouped.shrink_to_fit();
+        headers = std::move(grouped);
+        info = std::move(grouped_info);
+        header_group = group;
+    }
+
+    static void append_header(std::string_view prev, std::string_view h, bool in_full, std::string &out) {
+        if (in_full)
+            out.append(h);
+        else {
+            auto lcp = compute_lcp(prev, h);
+            encode_int(prev.length() - lcp, out);
+            out.append(h.substr(lcp));
+        }
+        out.push_back('\0');
+    }
+
+    struct ArenaAppender {
+        std::string &bytes;
+        std::vector<size_t> &offsets;
+
+        void operator()(std::string_view s) const {
+            offsets.push_back(bytes.size());
+            bytes.append(s);
+            bytes.push_back('\0');
+        }
+    };
+
+    /**
+     * Returns the block containing position i, which is not before the given block. If the positions are sampled, the
+     * search is restricted to the blocks between those of the samples around i, which are usually one or two.
+     */
+    size_t block_containing_position(size_t i, size_t first_block = 0) const {
+        if (info.empty())
+            return counts.successor(i + 1) - 1;
+        auto lo = info.begin() + first_block;
+        auto hi = info.end();
+        if (!position_samples.empty()) {
+            auto j = i >> position_shift;
+            lo = info.begin() + std::max<size_t>(first_block, position_samples[j]);
+            hi = info.begin() + position_samples[j + 1] + 1;
+        }
+        auto it = std::upper_bound(lo, hi, i, [](auto &a, auto &b) { return a < b.count; });
         return std::distance(info.begin(), std::prev(it));
     }
 
-    static std::pair<int, size_t> strcmp_lcp(const char *s1, size_t len1, const char *s2) {
-        size_t i = 0;
-        auto w1 = (const uint64_t *) s1;
-        auto w2 = (const uint64_t *) s2;
-        while (i + 8 < len1 && *w1++ == *w2++)
-            i += 8;
+    /** Samples one position every 2^shift, where the power of two is the closest below the strings per block. */
+    static size_t position_samples_shift(size_t n, size_t blocks) {
+        return n < 2 * blocks ? 0 : 63 - __builtin_clzll(n / blocks);
+    }
+
+    /** Appends the block once for each sampled position in its range [first, last). */
+    static void append_position_samples(size_t block, size_t first, size_t last, size_t shift,
+                                        std::vector<Offset> &samples) {
+        for (auto i = (first + (size_t(1) << shift) - 1) >> shift << shift; i < last; i += size_t(1) << shift)
+            samples.push_back(Offset(block));
+    }
+
+    size_t count_at(size_t block) const { return info.empty() ? counts[block] : info[block].count; }
+
+    size_t data_pointer_at(size_t block) const {
+        return info.empty() ? data_pointers[block] : info[block].data_pointer;
+    }
+
+    size_t header_pointer_at(size_t block) const {
+        return info.empty() ? header_pointers[block] : info[block].header_pointer;
+    }
+
+    /** Replaces the block directory with three Elias-Fano sequences, which are monotone since blocks are not empty. */
+    void compact_directory() {
+        auto sequence = [&](auto field) {
+            return rca::EliasFano(info.size(), field(info.back()), [&](auto push) {
+                for (auto &b: info)
+                    push(field(b));
+            });
+        };
+        counts = sequence([](const BlockInfo &b) { return uint64_t(b.count); });
+        data_pointers = sequence([](const BlockInfo &b) { return uint64_t(b.data_pointer); });
+        header_pointers = sequence([](const BlockInfo &b) { return uint64_t(b.header_pointer); });
+        info = {};
+    }
 
+    static std::pair<int, size_t> strcmp_lcp(const char *s1, size_t len1, const char *s2) {
+        auto i = rca::mismatch(s1, s2, len1);
         while (true) {
             unsigned char u1 = s1[i];
             unsigned char u2 = s2[i];
@@ -161,31 +743,147 @@ private:
         }
     }
 
-    static size_t lcp64(const char *s1, size_t len1, const char *s2) {
-        size_t i = 0;
-        auto w1 = (const uint64_t *) s1;
-        auto w2 = (const uint64_t *) s2;
-        while (i + 8 < len1 && *w1++ == *w2++)
-            i += 8;
-        while (i != len1 && s1[i] == s2[i])
-            ++i;
-        return i;
+    static size_t lcp64(const char *s1, size_t len1, const char *s2) { return rca::mismatch(s1, s2, len1); }
+
+    /**
+     * Returns whether a string that shares from bytes with pattern, then continues with suffix[0, suffix_len), is
+     * greater than pattern, given the LCP of the suffix and the rest of pattern. The suffixes of the split layout are
+     * not terminated, so this relies on the lengths only.
+     */
+    static bool suffix_greater(std::string_view pattern, size_t from, const char *suffix, size_t suffix_len,
+                               size_t lcp) {
+        return lcp < suffix_len
+            && (from + lcp == pattern.length() || uint8_t(pattern[from + lcp]) < uint8_t(suffix[lcp]));
+    }
+
+    /**
+     * Returns block_containing_string(s) and the header of that block. The search on grouped headers decodes the
+     * header of the block as it goes, instead of decoding it again afterwards.
+     */
+    std::pair<size_t, const char *> block_and_header_containing_string(std::string_view s) const {
+        auto &buffer = header_buffer();
+        if (header_group == 1 || !index.empty()) {
+            auto block = block_containing_string(s);
+            return {block, header(block, buffer)};
+        }
+        auto block = grouped_block_containing_string(s, 0, blocks_count(), &buffer);
+        buffer.reserve(buffer.length() + rca::simd_padding); // The vectorized comparisons may read past the end
+        return {block, buffer.c_str()};
     }
 
     size_t block_containing_string(std::string_view s) const {
-        size_t lo = 0;
-        size_t hi = blocks_count();
+        if (!index.empty())
+            return indexed_block_containing_string(s);
+        return block_containing_string(s, 0, blocks_count());
+    }
+
+    /**
+     * Searches the Eytzinger index for the first header > s. Every header in the subtree of a slot shares with s the
+     * prefix shared by the bounds of the subtree, so the 8 bytes of the headers that follow it decide most comparisons
+     * without touching the headers, which are read only when the same bytes of s are equal to the slot key.
+     */
+    size_t indexed_block_containing_string(std::string_view s) const {
+        auto first_header = plain_header(0);
+        auto prefix_lcp = lcp64(s.data(), std::min(s.length(), index_skip), first_header);
+        if (prefix_lcp < index_skip)
+            return uint8_t(s[prefix_lcp]) < uint8_t(first_header[prefix_lcp]) ? 0 : blocks_count() - 1;
+
+        auto slots = index.data();
+        auto m = index.size() - 1;
+        size_t llcp = index_skip;
+        size_t rlcp = index_skip;
+        size_t k = 1;
+        auto &scratch = header_buffer();
+        while (k <= m) {
+            RCA_COUNT(header_comparisons, 1);
+            __builtin_prefetch(slots + 4 * k); // The four descendants two levels below, which share a cache line
+            auto &slot = slots[k];
+            auto key = header_key({s.data() + slot.offset, s.length() - slot.offset});
+            bool leq;
+            size_t lcp;
+            if (slot.key != key) {
+                leq = slot.key < key;
+                lcp = slot.offset + __builtin_clzll(slot.key ^ key) / 8;
+            } else {
+                auto skip = std::max(std::min(llcp, rlcp), slot.offset + std::min<size_t>(s.length() - slot.offset, 8));
+                auto [cmp_result, tail_lcp] = strcmp_lcp(s.data() + skip, s.length() - skip,
+                                                         header(slot.block, scratch) + skip);
+                leq = cmp_result >= 0;
+                lcp = skip + tail_lcp;
+            }
+            (leq ? llcp : rlcp) = lcp;
+            k = 2 * k + leq;
+        }
+        k >>= __builtin_ffsll(~k);
+        size_t upper = k == 0 ? m : slots[k].block;
+        return upper - (upper != 0);
+    }
+
+    /** Returns the first 8 bytes of s, zero-padded, as a big-endian integer, so that keys compare like strings. */
+    static uint64_t header_key(std::string_view s) {
+        uint64_t word = 0;
+        std::memcpy(&word, s.data(), std::min<size_t>(s.length(), 8));
+        return __builtin_bswap64(word);
+    }
+
+    /**
+     * Lays out the headers in Eytzinger order, i.e. the BFS order of a complete binary search tree, and stores in each
+     * slot the 8 bytes of its header that follow the prefix shared by the bounds of the subtree. Sets skip to the
+     * length of the prefix shared by all headers, which bounds the subtrees of the leftmost and rightmost paths.
+     */
+    template<typename HeaderAt>
+    static std::vector<IndexSlot> header_index(size_t blocks, HeaderAt header_at, size_t &skip) {
+        if (blocks > std::numeric_limits<uint32_t>::max())
+            throw std::length_error("too many blocks for a header index");
+        std::vector<IndexSlot> slots(blocks + 1);
+        uint32_t i = 0;
+        auto assign_blocks = [&](auto &self, size_t k) -> void {
+            if (k > blocks)
+                return;
+            self(self, 2 * k);
+            slots[k].block = i++;
+            self(self, 2 * k + 1);
+        };
+        assign_blocks(assign_blocks, 1);
+
+        skip = compute_lcp(header_at(0), header_at(blocks - 1));
+        constexpr auto none = size_t(-1);
+        auto assign_keys = [&](auto &self, size_t k, size_t left, size_t right) -> void {
+            if (k > blocks)
+                return;
+            auto block = slots[k].block;
+            auto offset = left == none || right == none ? skip : compute_lcp(header_at(left), header_at(right));
+            offset = std::min<size_t>(offset, std::numeric_limits<uint32_t>::max());
+            auto h = header_at(block) + offset;
+            slots[k].key = header_key({h, strnlen(h, 8)});
+            slots[k].offset = uint32_t(offset);
+            self(self, 2 * k, left, block);
+            self(self, 2 * k + 1, block, right);
+        };
+        assign_keys(assign_keys, 1, none, none);
+        return slots;
+    }
+
+    /** Returns the last block in [lo, hi) whose header is <= s, or lo if there is none. */
+    size_t block_containing_string(std::string_view s, size_t lo, size_t hi) const {
+        if (header_group > 1)
+            return grouped_block_containing_string(s, lo, hi);
+
+        auto first = lo;
         size_t count = hi - lo;
         size_t llcp = 0;
         size_t rlcp = 0;
         while (count > 0) {
             auto step = count / 2;
             auto i = lo + step;
-            __builtin_prefetch(headers.data() + info[lo + step / 2].header_pointer);
-            __builtin_prefetch(headers.data() + info[lo + step + step / 2].header_pointer);
+            if (!info.empty()) { // Locating the headers of the compact directory costs more than the prefetch saves
+                __builtin_prefetch(plain_header(lo + step / 2));
+                __builtin_prefetch(plain_header(lo + step + step / 2));
+            }
+            RCA_COUNT(header_comparisons, 1);
             auto min_lcp = std::min(llcp, rlcp);
             auto[cmp_result, lcp] = strcmp_lcp(s.data() + min_lcp, s.length() - min_lcp,
-                                               headers.data() + info[i].header_pointer + min_lcp);
+                                               plain_header(i) + min_lcp);
             lcp += min_lcp;
             if (cmp_result >= 0) {
                 llcp = lcp;
@@ -196,40 +894,280 @@ private:
                 count = step;
             }
         }
-        return lo - (lo != 0);
+        return lo - (lo != first);
+    }
+
+    /**
+     * Like block_containing_string(s, lo, hi) on grouped headers: binary searches the first headers of the groups,
+     * which are stored in full, then decodes the headers of a single group.
+     */
+    size_t grouped_block_containing_string(std::string_view s, size_t lo, size_t hi,
+                                           std::string *header = nullptr) const {
+        auto first_group = (lo + header_group - 1) / header_group;
+        auto g = first_group;
+        size_t count = (hi + header_group - 1) / header_group - first_group;
+        size_t llcp = 0;
+        size_t rlcp = 0;
+        while (count > 0) {
+            auto step = count / 2;
+            auto i = g + step;
+            RCA_COUNT(header_comparisons, 1);
+            auto min_lcp = std::min(llcp, rlcp);
+            auto[cmp_result, lcp] = strcmp_lcp(s.data() + min_lcp, s.length() - min_lcp,
+                                               plain_header(i * header_group) + min_lcp);
+            lcp += min_lcp;
+            if (cmp_result >= 0) {
+                llcp = lcp;
+                g = i + 1;
+                count -= step + 1;
+            } else {
+                rlcp = lcp;
+                count = step;
+            }
+        }
+
+        auto group_first_block = (g == first_group ? lo / header_group : g - 1) * header_group;
+        auto group_end_block = std::min(hi, group_first_block + header_group);
+        auto group_ptr = plain_header(group_first_block);
+        HeaderGroupReader entries(group_ptr + rca::string_length(group_ptr) + 1, 0, false);
+        auto group_blocks = group_end_block - group_first_block;
+        auto headers_leq = rear_coded_search(s, group_ptr, entries, group_blocks, header).first;
+        if (headers_leq == 0 || group_first_block + headers_leq - 1 < lo) {
+            if (header)
+                decode_header(lo, *header);
+            return lo;
+        }
+        return group_first_block + headers_leq - 1;
     }
 
-    size_t block_rank(std::string_view pattern, size_t block) const {
-        auto header_ptr = headers.data() + info[block].header_pointer;
+    /**
+     * Returns the partition point of the headers in [lo, lo + count) w.r.t. prefix, where headers that extend prefix
+     * are considered greater than it if ExtensionsAreGreater, and smaller otherwise. llcp and rlcp are the LCPs between
+     * prefix and the headers delimiting the range, if any.
+     */
+    template<bool ExtensionsAreGreater>
+    size_t headers_partition_point(std::string_view prefix, size_t lo, size_t count, size_t llcp, size_t rlcp) const {
+        auto &scratch = header_buffer();
+        while (count > 0) {
+            auto step = count / 2;
+            auto i = lo + step;
+            auto header_ptr = header(i, scratch);
+            auto lcp = std::min(llcp, rlcp);
+            lcp += lcp64(prefix.data() + lcp, prefix.length() - lcp, header_ptr + lcp);
+            auto header_leq = lcp == prefix.length() ? !ExtensionsAreGreater || header_ptr[lcp] == '\0'
+                                                     : uint8_t(prefix[lcp]) > uint8_t(header_ptr[lcp]);
+            if (header_leq) {
+                llcp = lcp;
+                lo = i + 1;
+                count -= step + 1;
+            } else {
+                rlcp = lcp;
+                count = step;
+            }
+        }
+        return lo;
+    }
+
+    /**
+     * Returns the blocks that contain the first string >= prefix and the last string that is < prefix or starts with
+     * it. The two binary searches coincide until the probed header extends prefix.
+     */
+    std::pair<size_t, size_t> blocks_containing_prefix(std::string_view prefix) const {
+        size_t lo = 0;
+        size_t count = blocks_count();
+        size_t llcp = 0;
+        size_t rlcp = 0;
+        auto &scratch = header_buffer();
+        while (count > 0) {
+            auto step = count / 2;
+            auto i = lo + step;
+            auto header_ptr = header(i, scratch);
+            auto lcp = std::min(llcp, rlcp);
+            lcp += lcp64(prefix.data() + lcp, prefix.length() - lcp, header_ptr + lcp);
+            if (lcp == prefix.length() && header_ptr[lcp] != '\0') {
+                auto lo_end = headers_partition_point<true>(prefix, lo, step, llcp, lcp);
+                auto hi_end = headers_partition_point<false>(prefix, i + 1, count - step - 1, lcp, rlcp);
+                return {lo_end - (lo_end != 0), hi_end - 1};
+            }
+
+            if (lcp == prefix.length() || uint8_t(prefix[lcp]) > uint8_t(header_ptr[lcp])) {
+                llcp = lcp;
+                lo = i + 1;
+                count -= step + 1;
+            } else {
+                rlcp = lcp;
+                count = step;
+            }
+        }
+        return {lo - (lo != 0), lo - (lo != 0)};
+    }
+
+    /** Returns the number of strings in the block that are < prefix, and those that are < prefix or start with it. */
+    std::pair<size_t, size_t> block_prefix_rank(std::string_view prefix, size_t block) const {
+        auto &scratch = header_buffer();
+        auto header_ptr = header(block, scratch);
+        auto pattern_lcp = lcp64(prefix.data(), prefix.length(), header_ptr); // LCP b/w current string and prefix
+        auto matching = pattern_lcp == prefix.length();                        // Whether current starts with prefix
+        if (!matching && uint8_t(prefix[pattern_lcp]) < uint8_t(header_ptr[pattern_lcp]))
+            return {0, 0};
+
+        size_t lo = 0;
+        auto reader = block_reader(block);
+        auto strings_in_block = count_at(block + 1) - count_at(block);
+        auto curr_length = pattern_lcp + rca::string_length(header_ptr + pattern_lcp);
+        for (size_t j = 1; j < strings_in_block; ++j) {
+            j += reader.skip_lcp_above(pattern_lcp, curr_length, strings_in_block - j);
+            if (j == strings_in_block)
+                break;
+            RCA_COUNT(strings_decoded, 1);
+            auto suffix_to_remove = reader.rear_length();
+            auto prev_string_lcp = curr_length - suffix_to_remove;
+            if (prev_string_lcp < pattern_lcp)
+                return {matching ? lo : j, j};
+
+            auto suffix_len = reader.suffix_length();
+            if (prev_string_lcp == pattern_lcp && !matching) {
+                auto suffix = reader.suffix();
+                auto rest = prefix.length() - pattern_lcp;
+                auto lcp = lcp64(prefix.data() + pattern_lcp, std::min(rest, suffix_len), suffix);
+                pattern_lcp += lcp;
+                matching = pattern_lcp == prefix.length();
+                if (matching)
+                    lo = j;
+                else if (lcp < suffix_len && uint8_t(prefix[pattern_lcp]) < uint8_t(suffix[lcp]))
+                    return {j, j};
+            }
+
+            reader.skip(suffix_len);
+            curr_length = prev_string_lcp + suffix_len;
+        }
+
+        return {matching ? lo : strings_in_block, strings_in_block};
+    }
+
+    size_t block_rank(std::string_view pattern, size_t block) const { return block_search(pattern, block).first; }
+
+    /** Returns the number of strings in the block that are <= pattern, and whether the last of them equals pattern. */
+    std::pair<size_t, bool> block_search(std::string_view pattern, size_t block) const {
+        return rear_coded_search(pattern, header(block, header_buffer()), block);
+    }
+
+    std::pair<size_t, bool> rear_coded_search(std::string_view pattern, const char *header_ptr, size_t block) const {
+        auto strings_in_block = count_at(block + 1) - count_at(block);
+        return rear_coded_search(pattern, header_ptr, block_reader(block), strings_in_block);
+    }
+
+    /**
+     * Returns the number of strings <= pattern in a rear-coded sequence of count strings, whose first one is header
+     * and the others are read by reader, and whether the last of them equals pattern. If last_leq is not null and some
+     * string is <= pattern, the last such string is assigned to it, otherwise the strings that share with their
+     * predecessor more than they share with pattern are skipped by their lengths, if the layout allows it.
+     */
+    template<typename Reader>
+    static std::pair<size_t, bool> rear_coded_search(std::string_view pattern, const char *header_ptr, Reader reader,
+                                                     size_t count, std::string *last_leq = nullptr) {
         auto pattern_lcp = lcp64(pattern.data(), pattern.length(), header_ptr); // LCP b/w current string and pattern
-        if (pattern[pattern_lcp] < header_ptr[pattern_lcp])
-            return 0;
+        if (uint8_t(pattern[pattern_lcp]) < uint8_t(header_ptr[pattern_lcp])) {
+            RCA_COUNT(early_exits, 1);
+            return {0, false};
+        }
+        if (last_leq)
+            *last_leq = header_ptr;
 
-        auto data_ptr = data.data() + info[block].data_pointer;
-        auto strings_in_block = info[block + 1].count - info[block].count;
-        auto curr_length = pattern_lcp + strlen(header_ptr + pattern_lcp); // Length of the current string
+        auto curr_length = pattern_lcp + rca::string_length(header_ptr + pattern_lcp); // Length of the current string
+        auto found = [&] { return pattern_lcp == pattern.length() && curr_length == pattern.length(); };
         //for (auto i = 0; i <= block_bytes; i += 64)
         //    __builtin_prefetch(data_ptr + i);
 
-        for (int j = 1; j < strings_in_block; ++j) {
-            auto suffix_to_remove = decode_int(data_ptr);
+        for (size_t j = 1; j < count; ++j) {
+            if (!last_leq) {
+                j += reader.skip_lcp_above(pattern_lcp, curr_length, count - j);
+                if (j == count)
+                    break;
+            }
+            RCA_COUNT(strings_decoded, 1);
+            auto suffix_to_remove = reader.rear_length();
             auto prev_string_lcp = curr_length - suffix_to_remove; // LCP b/w curr and previous string in the block
-            if (prev_string_lcp < pattern_lcp)
-                return j;
+            if (prev_string_lcp < pattern_lcp) {
+                RCA_COUNT(early_exits, 1);
+                return {j, found()};
+            }
 
+            auto suffix_len = reader.suffix_length();
             if (prev_string_lcp == pattern_lcp) {
-                auto lcp = lcp64(pattern.data() + prev_string_lcp, pattern.length() - prev_string_lcp, data_ptr);
+                auto lcp = lcp64(pattern.data() + pattern_lcp, std::min(pattern.length() - pattern_lcp, suffix_len),
+                                 reader.suffix());
+                if (suffix_greater(pattern, pattern_lcp, reader.suffix(), suffix_len, lcp)) {
+                    RCA_COUNT(early_exits, 1);
+                    return {j, found()};
+                }
                 pattern_lcp += lcp;
-                if (pattern[pattern_lcp] < data_ptr[lcp])
-                    return j;
             }
 
-            auto suffix_len = std::strlen(data_ptr);
-            data_ptr += suffix_len + 1;
-            curr_length = curr_length - suffix_to_remove + suffix_len;
+            if (last_leq) {
+                last_leq->resize(prev_string_lcp);
+                last_leq->append(reader.suffix(), suffix_len);
+            }
+            reader.skip(suffix_len);
+            curr_length = prev_string_lcp + suffix_len;
         }
 
-        return strings_in_block;
+        return {count, found()};
+    }
+
+    static uint64_t mix(uint64_t x) {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdull;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ull;
+        x ^= x >> 33;
+        return x;
+    }
+
+    static uint64_t hash(std::string_view s) {
+        uint64_t h = 0x9e3779b97f4a7c15ull ^ s.length();
+        size_t i = 0;
+        for (; i + 8 <= s.length(); i += 8) {
+            uint64_t word;
+            std::memcpy(&word, s.data() + i, 8);
+            h = mix(h ^ word) + i;
+        }
+        uint64_t word = 0;
+        std::memcpy(&word, s.data() + i, s.length() - i);
+        return mix(h ^ word);
+    }
+
+    /** Each key sets filter_hashes bits in a 512-bit block of the filter, which is one cache line. */
+    void build_filter(const std::vector<uint64_t> &hashes, size_t bits_per_key) {
+        auto blocks = filter_blocks(hashes.size(), bits_per_key);
+        filter_hashes = filter_hashes_per_key(bits_per_key);
+        std::vector<uint64_t> words(blocks * 8);
+        for (auto h: hashes)
+            for_each_filter_bit(h, blocks, filter_hashes, [&](size_t word, uint64_t bit) { words[word] |= bit; });
+        filter = std::move(words);
+    }
+
+    bool filter_may_contain(uint64_t h) const {
+        bool result = true;
+        for_each_filter_bit(h, filter.size() / 8, filter_hashes, [&](size_t word, uint64_t bit) {
+            result &= (filter[word] & bit) != 0;
+        });
+        return result;
+    }
+
+    static size_t filter_blocks(size_t keys, size_t bits_per_key) { return (keys * bits_per_key + 511) / 512; }
+
+    static size_t filter_hashes_per_key(size_t bits_per_key) {
+        return std::clamp<size_t>(bits_per_key * 69 / 100, 1, 16); // bits_per_key * ln(2)
+    }
+
+    template<typename F>
+    static void for_each_filter_bit(uint64_t h, size_t blocks, size_t hashes, F f) {
+        auto first_word = ((h >> 32) * blocks >> 32) * 8;
+        auto a = uint32_t(h);
+        auto b = uint32_t(h >> 23) | 1;
+        for (size_t k = 0; k < hashes; ++k, a += b)
+            f(first_word + (a >> 6 & 7), uint64_t(1) << (a & 63));
     }
 
     static void encode_int(size_t x, uint8_t *&out) {
@@ -261,21 +1199,580 @@ private:
         return result;
     }
 
+    static constexpr uint8_t split_escape = 255; ///< A length of the split layout stored among the exceptions
+
+    /** Returns whether the blocks are in the split layout, given the one requested if Codec does not fix it. */
+    static constexpr bool split_layout(bool requested) {
+        return Codec == rca::RearLengthCodec::Runtime ? requested : Codec == rca::RearLengthCodec::Split;
+    }
+
+    /**
+     * Collects the strings of a block that follow its header, and writes them in the layout read by BlockReader. The
+     * split layout starts with the lengths of all the strings, so a block is written only when it is complete.
+     */
+    struct BlockEncoder {
+        bool split;
+        std::string bytes;          ///< The entries of the classic layout, or the suffixes of the split one
+        std::string rear_lengths;   ///< Rear lengths of the split layout, a byte each or split_escape
+        std::string suffix_lengths; ///< Suffix lengths of the split layout, a byte each or split_escape
+        std::string exceptions;     ///< Escaped lengths minus split_escape, as varints in the order they are read
+
+        explicit BlockEncoder(bool split) : split(split) {}
+
+        /** Returns about the bytes of the block, which differ by the length of a varint at most. */
+        size_t size() const { return bytes.size() + rear_lengths.size() + suffix_lengths.size() + exceptions.size(); }
+
+        void push_back(size_t rear_length, std::string_view suffix) {
+            if (split) {
+                put_length(rear_length, rear_lengths);
+                put_length(suffix.length(), suffix_lengths);
+                bytes.append(suffix);
+            } else {
+                encode_int(rear_length, bytes);
+                bytes.append(suffix);
+                bytes.push_back('\0');
+            }
+        }
+
+        /** Passes the block to write(const char *, size_t), in one or more pieces, and starts a new block. */
+        template<typename Write>
+        void flush(Write write) {
+            if (split) {
+                std::string exceptions_bytes;
+                encode_int(exceptions.size(), exceptions_bytes);
+                for (auto stream: {&exceptions_bytes, &rear_lengths, &suffix_lengths, &exceptions}) {
+                    write(stream->data(), stream->size());
+                    stream->clear();
+                }
+            }
+            write(bytes.data(), bytes.size());
+            bytes.clear();
+        }
+
+    private:
+
+        void put_length(size_t length, std::string &stream) {
+            stream.push_back(char(std::min<size_t>(length, split_escape)));
+            if (length >= split_escape)
+                encode_int(length - split_escape, exceptions);
+        }
+    };
+
+    /**
+     * Returns the offset in a block of the bytes that are Huffman-coded: the entries in the classic layout, or the
+     * suffixes in the split one, after the lengths of the count strings that follow the header.
+     */
+    static size_t coded_offset(const char *block, size_t count, bool split) {
+        if (!split)
+            return 0;
+        auto ptr = block;
+        auto exceptions_bytes = decode_int(ptr);
+        return size_t(ptr - block) + 2 * count + exceptions_bytes;
+    }
+
+    /**
+     * Reads the strings of a block that follow its header. In the classic layout, each string is the varint length of
+     * the suffix of the previous string to remove, then the suffix to append and a \0. In the split layout, the block
+     * starts with the varint byte size of its exceptions, then come the rear lengths of all the strings, their suffix
+     * lengths, the exceptions and the suffixes without terminators. Thus, the strings that a search would not compare
+     * can be skipped by their lengths, several at a time, without reading their bytes.
+     *
+     * With a Huffman code, the bytes from coded_offset() on are replaced by their varint count followed by their
+     * codewords, which the reader decodes into a buffer that it then reads as a plain block, so that the loops over the
+     * strings are the same in both cases. The buffer is the one of the calling thread, which the next reader it
+     * constructs reuses, and the reader decodes it on demand, in pieces of growing size as it reaches the strings that
+     * are not decoded yet, so that a query decodes the block only up to the string where it stops. A reader that owns
+     * its buffer decodes the whole block at once instead, since its copies share the buffer and may read it at
+     * different strings, while a piece decoded on demand overwrites the bytes past it.
+     *
+     * The layout is the one of the reader if Layout fixes it, so that the tests of the layout for each string are
+     * resolved at compile time, or else the one given at construction.
+     */
+    template<rca::RearLengthCodec Layout>
+    class BasicBlockReader {
+        const char *bytes;          ///< The next entry, or the suffix of the next string in the split layout
+        const uint8_t *lengths;     ///< The rear length of the next string in the split layout, null in the classic one
+        const char *exceptions;
+        size_t count;               ///< Strings after the header, thus distance from a rear length to its suffix length
+        std::shared_ptr<char[]> decoded; ///< The decoded bytes of a Huffman-coded block if owned, shared by the copies
+        std::optional<rca::HuffmanCode::Decoder> decoder; ///< Decodes the rest of a Huffman-coded block
+        char *decoded_end = nullptr;     ///< The end of the bytes decoded so far
+        const char *available = nullptr; ///< The end of the decoded bytes that can be read, see decode_until()
+        size_t remaining = 0;            ///< The number of coded bytes not decoded yet
+        size_t piece = 64;               ///< The number of bytes to decode next
+
+        size_t length(size_t offset) {
+            size_t length = lengths[offset];
+            return length == split_escape ? length + decode_int(exceptions) : length;
+        }
+
+        /** Returns the buffer of the calling thread for decoding blocks, grown to at least size bytes. */
+        static char *decoding_buffer(size_t size) {
+            thread_local std::unique_ptr<char[]> buffer;
+            thread_local size_t capacity = 0;
+            if (capacity < size) {
+                capacity = std::max(size, 2 * capacity);
+                buffer.reset(new char[capacity]);
+            }
+            return buffer.get();
+        }
+
+        /**
+         * Decodes pieces of the block until the bytes before needed are readable, i.e., in the classic layout, until
+         * the entry starting before needed is complete: the last byte of its varint followed by its suffix and \0.
+         */
+        void decode_until(const char *needed) {
+            while (available < needed && remaining > 0) {
+                auto missing = needed > decoded_end ? size_t(needed - decoded_end) : 0;
+                auto piece_bytes = std::min(std::max(piece, missing), remaining);
+                decoder->decode(piece_bytes, decoded_end);
+                decoded_end += piece_bytes;
+                remaining -= piece_bytes;
+                piece *= 2;
+                std::memset(decoded_end, 0, rca::simd_padding); // The vectorized loops may read past the end
+                if (split() || remaining == 0) {
+                    available = decoded_end;
+                    continue;
+                }
+                for (const char *end = decoded_end;;) {
+                    auto varint_end = std::find_if(available, end, [](char c) { return c < 0; });
+                    if (varint_end == end)
+                        break;
+                    auto suffix = varint_end + 1;
+                    auto terminator = static_cast<const char *>(std::memchr(suffix, '\0', end - suffix));
+                    if (terminator == nullptr)
+                        break;
+                    available = terminator + 1;
+                }
+            }
+        }
+
+        bool split() const {
+            if constexpr (Layout == rca::RearLengthCodec::Runtime)
+                return lengths != nullptr;
+            else
+                return Layout == rca::RearLengthCodec::Split;
+        }
+
+    public:
+
+        BasicBlockReader(const char *block, size_t count, bool split, const rca::HuffmanCode *code = nullptr,
+                         bool owned = false)
+            : bytes(block), lengths(nullptr), exceptions(nullptr), count(count) {
+            if (split) {
+                auto exceptions_bytes = decode_int(bytes);
+                lengths = reinterpret_cast<const uint8_t *>(bytes);
+                exceptions = bytes + 2 * count;
+                bytes = exceptions + exceptions_bytes;
+            }
+            if (code) {
+                auto total = decode_int(bytes);
+                char *buffer;
+                if (owned) {
+                    decoded.reset(new char[total + rca::simd_padding]);
+                    buffer = decoded.get();
+                } else {
+                    buffer = decoding_buffer(total + rca::simd_padding);
+                }
+                std::memset(buffer, 0, rca::simd_padding);
+                decoder.emplace(*code, bytes);
+                bytes = available = decoded_end = buffer;
+                remaining = total;
+                if (owned) {
+                    piece = total;
+                    decode_until(buffer + total);
+                }
+            }
+        }
+
+        /** Reads the length of the suffix of the previous string that the next one does not share. */
+        size_t rear_length() {
+            if (split())
+                return length(0);
+            if (remaining > 0 && bytes >= available)
+                decode_until(bytes + 1);
+            return decode_int(bytes);
+        }
+
+        /** Reads the length of the suffix of the next string, after its rear_length(). */
+        size_t suffix_length() {
+            if (!split())
+                return rca::string_length(bytes);
+            auto result = length(count);
+            ++lengths;
+            if (remaining > 0 && bytes + result > available)
+                decode_until(bytes + result);
+            return result;
+        }
+
+        const char *suffix() const { return bytes; }
+
+        /** Moves to the next string, given the suffix_length() of the current one. */
+        void skip(size_t suffix_length) {
+            RCA_COUNT(bytes_decoded, suffix_length);
+            bytes += suffix_length + !split();
+        }
+
+        /**
+         * Skips the next strings, up to max, that share with their predecessor more than lcp bytes, where the length of
+         * the string before them is curr_length and is updated. Returns the number of skipped strings, which is always
+         * zero in the classic layout.
+         */
+        size_t skip_lcp_above(size_t lcp, size_t &curr_length, size_t max) {
+            if (!split())
+                return 0;
+            size_t skipped = 0;
+            size_t suffix_bytes = 0;
+            auto stopped = false;
+            while (!stopped && max - skipped >= 8) {
+                auto k = rca::skip_lcp_above(lengths + skipped, lengths + count + skipped, lcp, curr_length,
+                                             suffix_bytes);
+                skipped += k;
+                stopped = k < 8;
+            }
+            while (!stopped && skipped < max) {
+                size_t rear = lengths[skipped];
+                size_t suffix = lengths[count + skipped];
+                stopped = rear == split_escape || suffix == split_escape || curr_length - rear <= lcp;
+                if (!stopped) {
+                    curr_length += suffix - rear;
+                    suffix_bytes += suffix;
+                    ++skipped;
+                }
+            }
+            RCA_COUNT(strings_skipped, skipped);
+            lengths += skipped;
+            bytes += suffix_bytes;
+            return skipped;
+        }
+    };
+
+    /**
+     * Returns a reader of the strings of the block after its header. A reader that owns its decoded bytes stays valid
+     * while the calling thread constructs others, e.g. in an iterator.
+     */
+    BlockReader block_reader(size_t block, bool owned = false) const {
+        auto split = split_layout(split_streams);
+        auto count = split ? count_at(block + 1) - count_at(block) - 1 : 0; // Not needed by the classic layout
+        return {data.data() + data_pointer_at(block), count, split, huffman.get(), owned};
+    }
+
+    /** Appends to out the given block, which has count strings after its header, with its coded bytes Huffman-coded. */
+    static void append_coded_block(std::string_view block, size_t count, bool split, const rca::HuffmanCode &code,
+                                   std::string &out) {
+        auto offset = coded_offset(block.data(), count, split);
+        out.append(block.substr(0, offset));
+        encode_int(block.size() - offset, out);
+        code.encode(block.substr(offset), out);
+    }
+
+    /**
+     * Replaces the blocks in data, whose directory entries are in info, with their Huffman-coded version. The code is
+     * built on the coded bytes of the first blocks, up to the sample size of rca::ByteHistogram, as in Builder.
+     */
+    void huffman_code_blocks(std::string &data, std::vector<BlockInfo> &info) {
+        auto block_end = [&](size_t b) {
+            return b + 1 < info.size() ? size_t(info[b + 1].data_pointer) : data.size();
+        };
+        auto block = [&](size_t b) {
+            return std::string_view(data).substr(info[b].data_pointer, block_end(b) - info[b].data_pointer);
+        };
+        auto count = [&](size_t b) {
+            return size_t((b + 1 < info.size() ? info[b + 1].count : n) - info[b].count - 1);
+        };
+
+        rca::ByteHistogram sample;
+        for (size_t b = 0; b < info.size() && !sample.full(); ++b)
+            sample.add(block(b).substr(coded_offset(block(b).data(), count(b), split_streams)));
+        huffman = std::make_shared<const rca::HuffmanCode>(sample);
+
+        std::string coded;
+        coded.reserve(data.size() + rca::simd_padding);
+        for (size_t b = 0; b < info.size(); ++b) {
+            auto plain = block(b);
+            info[b] = BlockInfo(info[b].count, coded.size(), info[b].header_pointer);
+            append_coded_block(plain, count(b), split_streams, *huffman, coded);
+        }
+        data = std::move(coded);
+    }
+
+    static constexpr size_t min_strings_per_thread = 1 << 16;
+
+    /** Rear-codes a sorted run of strings into blocks, whose pointers are relative to the start of the run. */
+    struct Encoder {
+        size_t block_bytes;
+        bool hashing;
+        BlockEncoder block; ///< The block being encoded, which is appended to data when the next one starts
+        std::string data;
+        std::string headers;
+        std::vector<BlockInfo> info;
+        std::vector<uint64_t> hashes;
+        std::string prev;
+        size_t n = 0;
+        size_t input_bytes = 0;
+        size_t max_length = 0;
+        size_t max_lcp = 0;
+        size_t sum_lcp = 0;
+
+        explicit Encoder(const Options &options)
+            : block_bytes(options.block_bytes), hashing(options.filter_bits_per_key > 0),
+              block(split_layout(options.split_streams)) {
+            data.reserve(1 << 22);
+            headers.reserve(1 << 20);
+        }
+
+        void push_back(std::string_view s) {
+            if (s <= prev)
+                throw std::invalid_argument("data is not sorted");
+
+            auto lcp = compute_lcp(prev, s);
+            max_lcp = std::max(max_lcp, lcp);
+            max_length = std::max(max_length, s.length());
+            sum_lcp += lcp;
+            input_bytes += s.length() + 1;
+            if (hashing)
+                hashes.push_back(hash(s));
+
+            if (n == 0 || block.size() >= block_bytes) {
+                finish();
+                info.emplace_back(n, data.size(), headers.size());
+                headers.append(s);
+                headers.push_back('\0');
+            } else
+                block.push_back(prev.length() - lcp, s.substr(lcp));
+            prev = s;
+            ++n;
+        }
+
+        /** Appends the current block to data, which must be done after the last string too. */
+        void finish() {
+            if (n > 0)
+                block.flush([&](const char *ptr, size_t bytes) { data.append(ptr, bytes); });
+        }
+    };
+
+    struct IndexSlot {
+        uint64_t key;    ///< Big-endian 8 bytes of the header that follow offset, zero-padded
+        uint32_t offset; ///< Length of the prefix shared by the bounds of the subtree, thus by s and the header
+        uint32_t block;  ///< Block of the header
+    };
+
     #pragma pack(push, 1)
     struct BlockInfo {
-        uint32_t count;          ///< Cumulative string count up to this block
-        uint32_t data_pointer;   ///< Pointer to the data block
-        uint32_t header_pointer; ///< Pointer to the header string
+        Offset count;          ///< Cumulative string count up to this block
+        Offset data_pointer;   ///< Pointer to the data block
+        Offset header_pointer; ///< Pointer to the header string
 
-        BlockInfo(uint32_t count, uint32_t data_pointer, uint32_t header_pointer)
-            : count(count), data_pointer(data_pointer), header_pointer(header_pointer) {}
+        BlockInfo(size_t count, size_t data_pointer, size_t header_pointer)
+            : count(count), data_pointer(data_pointer), header_pointer(header_pointer) {
+            constexpr auto max = std::numeric_limits<Offset>::max();
+            if (count > max || data_pointer > max || header_pointer > max)
+                throw std::length_error("the array exceeds the range of its offsets, use a wider Offset type");
+        }
     };
     #pragma pack(pop)
 
+    static constexpr size_t interleaved_lanes = 16;
+
+    /**
+     * A query of rank_interleaved(), which goes through the stages of the search one call of advance() at a time. Each
+     * stage prefetches the memory that the next one reads: a step of the header search compares the header prefetched
+     * by the previous step, then prefetches the header to compare next, whose directory entry was prefetched together
+     * with that of the other possible outcome, and the entries of the headers that can follow it. Once the block is
+     * found, its directory entry, then its header and data are prefetched.
+     */
+    struct RankLane {
+        enum Stage { Idle, Search, Load, Scan };
+
+        Stage stage = Idle;
+        std::string_view pattern;
+        size_t query = 0;
+        size_t lo = 0;    ///< The first header left to search, then the block found
+        size_t count = 0; ///< The number of headers left to search
+        size_t llcp = 0;
+        size_t rlcp = 0;
+        const char *header_ptr = nullptr;
+
+        void start(std::string_view s, size_t k, const BasicRearCodedArray *rca) {
+            stage = Search;
+            pattern = s;
+            query = k;
+            lo = 0;
+            count = rca->blocks_count();
+            llcp = 0;
+            rlcp = 0;
+            probe(rca);
+        }
+
+        void probe(const BasicRearCodedArray *rca) {
+            auto step = count / 2;
+            header_ptr = rca->plain_header(lo + step);
+            __builtin_prefetch(header_ptr);
+            __builtin_prefetch(&rca->info[lo + step / 2]);
+            __builtin_prefetch(&rca->info[lo + step + 1 + (count - step - 1) / 2]);
+        }
+
+        template<typename RandomIt>
+        void advance(const BasicRearCodedArray *rca, RandomIt out) {
+            switch (stage) {
+                case Search: {
+                    auto step = count / 2;
+                    auto min_lcp = std::min(llcp, rlcp);
+                    auto[cmp_result, lcp] = strcmp_lcp(pattern.data() + min_lcp, pattern.length() - min_lcp,
+                                                       header_ptr + min_lcp);
+                    lcp += min_lcp;
+                    if (cmp_result >= 0) {
+                        llcp = lcp;
+                        lo += step + 1;
+                        count -= step + 1;
+                    } else {
+                        rlcp = lcp;
+                        count = step;
+                    }
+                    if (count > 0)
+                        probe(rca);
+                    else {
+                        lo -= lo != 0;
+                        __builtin_prefetch(&rca->info[lo]);
+                        stage = Load;
+                    }
+                    break;
+                }
+                case Load: {
+                    auto data_ptr = rca->data.data() + rca->info[lo].data_pointer;
+                    for (size_t b = 0; b < std::min<size_t>(rca->block_bytes, 256); b += 64)
+                        __builtin_prefetch(data_ptr + b);
+                    header_ptr = rca->plain_header(lo);
+                    __builtin_prefetch(header_ptr);
+                    stage = Scan;
+                    break;
+                }
+                case Scan:
+                    out[query] = rca->count_at(lo) + rca->rear_coded_search(pattern, header_ptr, lo).first;
+                    stage = Idle;
+                    break;
+                case Idle:
+                    break;
+            }
+        }
+    };
+
+    /** The state of a sequential decoding of the strings, which starts from the header of a block. */
+    class Cursor {
+        const BasicRearCodedArray *rca;
+        size_t block;
+        BlockReader reader; // Reads the string following current in the block
+
+    public:
+        size_t position;      // Position of current, or n if the cursor is past the end
+        std::string current;  // The decoded string at the given position
+
+        Cursor() : rca(nullptr), block(0), reader(nullptr, 0, false), position(0) {}
+
+        explicit Cursor(const BasicRearCodedArray *rca)
+            : rca(rca), block(0), reader(nullptr, 0, false), position(rca->n) {}
+
+        /** Moves the cursor to position i, decoding forward from the current string if i is in the same block. */
+        void seek(size_t i) {
+            if (i >= rca->n) {
+                position = rca->n;
+                return;
+            }
+
+            if (position == rca->n || i < position || i >= rca->count_at(block + 1))
+                load_block(rca->block_containing_position(i, position != rca->n && i > position ? block + 1 : 0));
+
+            while (position < i)
+                step();
+        }
+
+        /** Moves the cursor to the next string, possibly in the next block. */
+        void next() {
+            if (position + 1 < rca->count_at(block + 1))
+                step();
+            else if (block + 1 < rca->blocks_count())
+                load_block(block + 1);
+            else
+                position = rca->n;
+        }
+
+    private:
+
+        void load_block(size_t b) {
+            block = b;
+            position = rca->count_at(b);
+            rca->decode_header(b, current);
+            reader = rca->block_reader(b, true);
+        }
+
+        void step() {
+            auto suffix_to_remove = reader.rear_length();
+            auto suffix_len = reader.suffix_length();
+            current.resize(current.length() - suffix_to_remove);
+            current.append(reader.suffix(), suffix_len);
+            reader.skip(suffix_len);
+            ++position;
+        }
+    };
+
+    /**
+     * A bidirectional iterator over the strings, which yields views into its own decoding buffer. Since the views do
+     * not outlive the iterator, it cannot be wrapped in a std::reverse_iterator.
+     */
+    class StringIterator {
+        Cursor cursor;
+
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::make_signed_t<size_t>;
+        using pointer = const std::string *;
+        using reference = std::string_view;
+
+        StringIterator() = default;
+
+        StringIterator(const BasicRearCodedArray *rca, size_t i) : cursor(rca) { cursor.seek(i); }
+
+        /** The returned view is invalidated when the iterator is moved. */
+        value_type operator*() const { return cursor.current; }
+
+        pointer operator->() const { return &cursor.current; }
+
+        /** Returns the position of the string pointed by the iterator. */
+        size_t position() const { return cursor.position; }
+
+        StringIterator &operator++() {
+            cursor.next();
+            return *this;
+        }
+
+        StringIterator operator++(int) {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        /** Rear-coding cannot be reversed, so this re-decodes the block from its header up to the previous string. */
+        StringIterator &operator--() {
+            cursor.seek(cursor.position - 1);
+            return *this;
+        }
+
+        StringIterator operator--(int) {
+            auto tmp = *this;
+            --*this;
+            return tmp;
+        }
+
+        bool operator==(const StringIterator &r) const { return cursor.position == r.cursor.position; }
+        bool operator!=(const StringIterator &r) const { return cursor.position != r.cursor.position; }
+    };
+
+    /** A random-access iterator over the headers, which decodes the grouped ones into its own buffer. */
     class HeaderIterator {
-        const char *headers_ptr;
+        const BasicRearCodedArray *rca;
         size_t block;
-        const BlockInfo *block_info_ptr;
+        mutable std::string scratch;
 
     public:
         using iterator_category = std::random_access_iterator_tag;
@@ -284,14 +1781,12 @@ private:
         using pointer = value_type *;
         using reference = const value_type &;
 
-        HeaderIterator(const char *ptr, size_t block, const BlockInfo *block_info_ptr)
-            : headers_ptr(ptr), block(block), block_info_ptr(block_info_ptr) {}
+        HeaderIterator(const BasicRearCodedArray *rca, size_t block) : rca(rca), block(block) {}
 
-        value_type operator*() const { return headers_ptr + block_info_ptr[block].header_pointer; }
+        /** The returned string is invalidated by the next dereference of the iterator. */
+        value_type operator*() const { return rca->header(block, scratch); }
 
-        value_type operator[](difference_type off) const {
-            return headers_ptr + block_info_ptr[block + off].header_pointer;
-        }
+        value_type operator[](difference_type off) const { return rca->header(block + off, scratch); }
 
         HeaderIterator &operator++() {
             ++block;
@@ -301,7 +1796,7 @@ private:
         HeaderIterator operator++(int) {
             auto b = block;
             ++*this;
-            return HeaderIterator(headers_ptr, b, block_info_ptr);
+            return HeaderIterator(rca, b);
         }
 
         HeaderIterator &operator--() {
@@ -312,7 +1807,7 @@ private:
         HeaderIterator operator--(int) {
             auto b = block;
             --*this;
-            return HeaderIterator(headers_ptr, b, block_info_ptr);
+            return HeaderIterator(rca, b);
         }
 
         HeaderIterator &operator+=(difference_type off) {
@@ -321,7 +1816,7 @@ private:
         }
 
         HeaderIterator operator+(difference_type off) const {
-            return HeaderIterator(headers_ptr, block + off, block_info_ptr);
+            return HeaderIterator(rca, block + off);
         }
 
         HeaderIterator &operator-=(difference_type off) {
@@ -330,7 +1825,7 @@ private:
         }
 
         HeaderIterator operator-(difference_type off) const {
-            return HeaderIterator(headers_ptr, block - off, block_info_ptr);
+            return HeaderIterator(rca, block - off);
         }
 
         difference_type operator-(const HeaderIterator &right) const { return difference_type(block - right.block); }
@@ -344,4 +1839,318 @@ private:
     };
 };
 
+/**
+ * Builds an array from strings pushed one at a time in sorted order, and writes it to a stream in the format read by
+ * load(). Blocks are written as soon as they are full, while headers, block directory and filter hashes are spilled to
+ * temporary files until finish() appends them, so memory stays bounded by a block and the longest string, plus the
+ * Bloom filter and the header index if enabled.
+ */
+template<typename Offset, rca::RearLengthCodec Codec>
+class BasicRearCodedArray<Offset, Codec>::Builder {
+    using File = std::unique_ptr<FILE, int (*)(FILE *)>;
+
+    std::ofstream file;
+    rca::Writer writer;
+    Options options;
+    BlockEncoder block;
+    std::string prev;
+    std::string prev_header;
+    std::string header_entry;
+    File headers;
+    File plain_headers; ///< Headers in full, needed only by the header index if they are grouped
+    File info;
+    File hashes;
+    size_t data_bytes;
+    size_t headers_bytes;
+    size_t plain_headers_bytes;
+    size_t blocks;
+    size_t n;
+    rca::BuildStats stats;
+    bool finished;
+    size_t block_start = 0;                         ///< Position of the header of the current block
+    std::shared_ptr<const rca::HuffmanCode> huffman; ///< Built once the blocks so far fill the sample
+    rca::ByteHistogram sample;
+    std::vector<std::string> pending_blocks;        ///< The plain blocks written before the code is built
+    std::vector<size_t> pending_counts;
+    std::vector<BlockInfo> pending_info;            ///< Their directory entries, whose data pointers are not yet known
+    std::string plain_block;
+    std::string coded_block;
+
+    static Options with_layout(Options options) {
+        options.split_streams = split_layout(options.split_streams);
+        return options;
+    }
+
+    static File temporary_file() {
+        File f(std::tmpfile(), &std::fclose);
+        if (!f)
+            throw std::runtime_error(std::string("cannot create a temporary file: ") + std::strerror(errno));
+        return f;
+    }
+
+    static File optional_temporary_file(bool needed) { return needed ? temporary_file() : File(nullptr, &std::fclose); }
+
+    static void spill(const File &f, const void *ptr, size_t bytes) {
+        if (std::fwrite(ptr, 1, bytes, f.get()) != bytes)
+            throw std::runtime_error("failed to write a temporary file");
+    }
+
+    /** Reads back a temporary file in chunks of whole elements of type T, passing each chunk to f. */
+    template<typename T, typename F>
+    static void replay(const File &f, F f_chunk) {
+        std::vector<T> buffer((1 << 16) / sizeof(T));
+        std::rewind(f.get());
+        size_t read;
+        while ((read = std::fread(buffer.data(), sizeof(T), buffer.size(), f.get())) > 0)
+            f_chunk(buffer.data(), read);
+        if (std::ferror(f.get()))
+            throw std::runtime_error("failed to read a temporary file");
+    }
+
+    void flush_block() {
+        if (!options.huffman_suffixes) {
+            block.flush([&](const char *ptr, size_t bytes) {
+                writer.write(ptr, bytes);
+                data_bytes += bytes;
+            });
+            return;
+        }
+
+        plain_block.clear();
+        block.flush([&](const char *ptr, size_t bytes) { plain_block.append(ptr, bytes); });
+        auto count = n - block_start - 1;
+        if (huffman) {
+            write_coded_block(plain_block, count);
+            return;
+        }
+        auto offset = coded_offset(plain_block.data(), count, options.split_streams);
+        sample.add(std::string_view(plain_block).substr(offset));
+        pending_blocks.push_back(plain_block);
+        pending_counts.push_back(count);
+        if (sample.full())
+            flush_pending_blocks();
+    }
+
+    void write_coded_block(std::string_view plain, size_t count) {
+        coded_block.clear();
+        append_coded_block(plain, count, options.split_streams, *huffman, coded_block);
+        writer.write(coded_block.data(), coded_block.size());
+        data_bytes += coded_block.size();
+    }
+
+    /** Builds the Huffman code on the sample, and writes the blocks and the directory entries kept until then. */
+    void flush_pending_blocks() {
+        huffman = std::make_shared<const rca::HuffmanCode>(sample);
+        for (size_t i = 0; i < pending_blocks.size(); ++i) {
+            BlockInfo entry(pending_info[i].count, data_bytes, pending_info[i].header_pointer);
+            spill(info, &entry, sizeof(entry));
+            write_coded_block(pending_blocks[i], pending_counts[i]);
+        }
+        pending_blocks.clear();
+        pending_counts.clear();
+        pending_info.clear();
+    }
+
+public:
+
+    Builder(std::ostream &out, const Options &options = {})
+        : writer(out, rca::Layout::SeparateHeaders), options(with_layout(options)),
+          block(split_layout(options.split_streams)),
+          headers(temporary_file()),
+          plain_headers(optional_temporary_file(options.header_index && options.header_group > 1)),
+          info(temporary_file()), hashes(optional_temporary_file(options.filter_bits_per_key > 0)),
+          data_bytes(0), headers_bytes(0), plain_headers_bytes(0), blocks(0), n(0), finished(false) {
+        writer.begin_section();
+    }
+
+    Builder(const std::string &path, const Options &options = {})
+        : file(path, std::ios::binary), writer(file, rca::Layout::SeparateHeaders), options(with_layout(options)),
+          block(split_layout(options.split_streams)), headers(temporary_file()),
+          plain_headers(optional_temporary_file(options.header_index && options.header_group > 1)),
+          info(temporary_file()), hashes(optional_temporary_file(options.filter_bits_per_key > 0)),
+          data_bytes(0), headers_bytes(0), plain_headers_bytes(0), blocks(0), n(0), finished(false) {
+        if (!file)
+            throw std::runtime_error(path + ": " + std::strerror(errno));
+        writer.begin_section();
+    }
+
+    void push_back(std::string_view s) {
+        if (finished)
+            throw std::logic_error("push_back after finish");
+        if (s <= prev)
+            throw std::invalid_argument("data is not sorted");
+
+        if (hashes) {
+            auto h = hash(s);
+            spill(hashes, &h, sizeof(h));
+        }
+
+        auto lcp = compute_lcp(prev, s);
+        stats.input_bytes += s.length() + 1;
+        stats.max_length = std::max<size_t>(stats.max_length, s.length());
+        stats.max_lcp = std::max<size_t>(stats.max_lcp, lcp);
+        stats.sum_lcp += lcp;
+
+        if (n == 0 || block.size() >= options.block_bytes) {
+            if (n > 0)
+                flush_block();
+            BlockInfo entry(n, data_bytes, headers_bytes);
+            if (options.huffman_suffixes && !huffman)
+                pending_info.push_back(entry);
+            else
+                spill(info, &entry, sizeof(entry));
+            block_start = n;
+            header_entry.clear();
+            auto in_full = options.header_group <= 1 || blocks % options.header_group == 0;
+            append_header(prev_header, s, in_full, header_entry);
+            spill(headers, header_entry.data(), header_entry.size());
+            headers_bytes += header_entry.size();
+            plain_headers_bytes += s.length() + 1;
+            if (plain_headers) {
+                spill(plain_headers, s.data(), s.length());
+                spill(plain_headers, "", 1);
+            }
+            if (blocks > 0) {
+                auto header_lcp = compute_lcp(prev_header, s);
+                stats.max_header_lcp = std::max<size_t>(stats.max_header_lcp, header_lcp);
+                stats.sum_header_lcp += header_lcp;
+            }
+            prev_header = s;
+            ++blocks;
+        } else
+            block.push_back(prev.length() - lcp, s.substr(lcp));
+        prev = s;
+        ++n;
+    }
+
+    size_t size() const { return n; }
+
+    /** Writes the remaining sections and the trailer. No strings can be pushed afterwards. */
+    void finish() {
+        if (finished)
+            throw std::logic_error("finish called twice");
+        finished = true;
+        if (n > 0)
+            flush_block();
+        if (options.huffman_suffixes && !huffman)
+            flush_pending_blocks();
+        static const char padding[rca::simd_padding] = {};
+        writer.write(padding, sizeof(padding));
+        data_bytes += sizeof(padding);
+        writer.end_section();
+
+        writer.begin_section();
+        replay<char>(headers, [&](const char *ptr, size_t count) { writer.write(ptr, count); });
+        writer.write(padding, sizeof(padding));
+        headers_bytes += sizeof(padding);
+        writer.end_section();
+
+        BlockInfo sentinel(n, data_bytes, headers_bytes);
+        writer.begin_section();
+        if (!options.compact_directory) {
+            replay<char>(info, [&](const char *ptr, size_t count) { writer.write(ptr, count); });
+            writer.write(&sentinel, sizeof(sentinel));
+        }
+        writer.end_section();
+
+        size_t filter_hashes = 0;
+        std::vector<uint64_t> words;
+        if (hashes && n > 0) {
+            auto blocks = filter_blocks(n, options.filter_bits_per_key);
+            filter_hashes = filter_hashes_per_key(options.filter_bits_per_key);
+            words.resize(blocks * 8);
+            replay<uint64_t>(hashes, [&](const uint64_t *ptr, size_t count) {
+                for (size_t i = 0; i < count; ++i)
+                    for_each_filter_bit(ptr[i], blocks, filter_hashes, [&](size_t w, uint64_t b) { words[w] |= b; });
+            });
+        }
+        writer.section(words);
+
+        size_t index_skip = 0;
+        std::vector<IndexSlot> index;
+        if (options.header_index && n > 0) {
+            auto &f = plain_headers ? plain_headers : headers;
+            std::fflush(f.get());
+            auto bytes = plain_headers_bytes;
+            auto addr = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fileno(f.get()), 0);
+            if (addr == MAP_FAILED)
+                throw std::runtime_error(std::string("cannot map a temporary file: ") + std::strerror(errno));
+            auto begin = static_cast<const char *>(addr);
+            std::vector<const char *> header_ptrs;
+            for (auto h = begin; h != begin + bytes; h += std::strlen(h) + 1)
+                header_ptrs.push_back(h);
+            try {
+                index = header_index(header_ptrs.size(), [&](size_t b) { return header_ptrs[b]; }, index_skip);
+            } catch (...) {
+                munmap(addr, bytes);
+                throw;
+            }
+            munmap(addr, bytes);
+        }
+        writer.section(index);
+
+        rca::EliasFano directory[3];
+        if (options.compact_directory) {
+            // The spilled entries are packed triples of count, data pointer and header pointer
+            uint64_t last[3] = {n, data_bytes, headers_bytes};
+            for (size_t field = 0; field < 3; ++field) {
+                directory[field] = rca::EliasFano(blocks + 1, last[field], [&](auto push) {
+                    size_t k = 0;
+                    replay<Offset>(info, [&](const Offset *ptr, size_t count) {
+                        for (size_t i = 0; i < count; ++i, ++k)
+                            if (k % 3 == field)
+                                push(ptr[i]);
+                    });
+                    push(last[field]);
+                });
+            }
+        }
+        for (auto &sequence: directory)
+            writer.section(sequence.storage());
+
+        size_t position_shift = 0;
+        std::vector<Offset> samples;
+        if (options.position_samples && !options.compact_directory && n > 0) {
+            position_shift = position_samples_shift(n, blocks);
+            size_t k = 0;
+            size_t block_first = 0;
+            replay<Offset>(info, [&](const Offset *ptr, size_t count) {
+                for (size_t i = 0; i < count; ++i, ++k)
+                    if (k % 3 == 0 && k > 0) {
+                        append_position_samples(k / 3 - 1, block_first, ptr[i], position_shift, samples);
+                        block_first = ptr[i];
+                    }
+            });
+            append_position_samples(blocks - 1, block_first, n, position_shift, samples);
+            samples.push_back(blocks - 1);
+        }
+        writer.section(samples);
+        writer.section(huffman ? std::string_view(reinterpret_cast<const char *>(huffman->code_lengths().data()), 256)
+                               : std::string_view());
+
+        writer.param(n);
+        writer.param(options.block_bytes);
+        writer.param(filter_hashes);
+        writer.param(sizeof(BlockInfo));
+        writer.param(index_skip);
+        writer.param(std::max<size_t>(1, options.header_group));
+        writer.param(position_shift);
+        writer.param(options.split_streams);
+        for (auto field: rca::build_stats_input_fields)
+            writer.param(stats.*field);
+        writer.finish();
+        headers.reset();
+        plain_headers.reset();
+        info.reset();
+        hashes.reset();
+    }
+};
+
+/** The default array, whose 12-byte block directory entries fit up to 4 GiB of data and 2^32 strings. */
+using RearCodedArray = BasicRearCodedArray<uint32_t>;
+
+/** An array with 64-bit counts and offsets, for dictionaries exceeding the limits of RearCodedArray. */
+using RearCodedArray64 = BasicRearCodedArray<uint64_t>;
 
+using RearCodedArrayBuilder = RearCodedArray::Builder;
+using RearCodedArray64Builder = RearCodedArray64::Builder;
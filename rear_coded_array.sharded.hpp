@@ -0,0 +1,340 @@
+//
+// A dictionary partitioned by key range into RearCodedArrays, built and queried in parallel.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "rear_coded_array.separate_headers.hpp"
+#include "rear_coded_array.storage.hpp"
+
+namespace rca {
+
+/** A fixed set of threads that run the iterations of parallel loops. */
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable available;
+    std::deque<std::function<void()>> tasks;
+    bool stopping = false;
+
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock lock(mutex);
+                available.wait(lock, [&] { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+public:
+
+    /** Creates a pool with threads - 1 workers, since the thread that calls parallel_for works as well. */
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency()) {
+        for (size_t t = 1; t < threads; ++t)
+            workers.emplace_back([this] { work(); });
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        available.notify_all();
+        for (auto &w: workers)
+            w.join();
+    }
+
+    size_t threads() const { return workers.size() + 1; }
+
+    /**
+     * Calls f(i) for each i in [0, count) on the workers and on the calling thread, and returns when all the calls
+     * did, rethrowing the first exception thrown by any of them. The calling thread takes iterations until none is
+     * left, so a parallel loop makes progress even if the workers are busy, e.g. with the loops of other threads.
+     */
+    template<typename F>
+    void parallel_for(size_t count, F f) {
+        struct Loop {
+            std::atomic<size_t> next{0};
+            std::mutex mutex;
+            std::condition_variable finished;
+            size_t completed = 0;
+            std::exception_ptr error;
+        };
+        auto loop = std::make_shared<Loop>();
+        auto f_ptr = &f;
+        auto run = [loop, count, f_ptr] {
+            for (size_t i; (i = loop->next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+                std::exception_ptr error;
+                try {
+                    (*f_ptr)(i);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                std::lock_guard lock(loop->mutex);
+                if (error && !loop->error)
+                    loop->error = error;
+                if (++loop->completed == count)
+                    loop->finished.notify_all();
+            }
+        };
+
+        auto helpers = std::min(workers.size(), count == 0 ? 0 : count - 1);
+        if (helpers > 0) {
+            {
+                std::lock_guard lock(mutex);
+                for (size_t h = 0; h < helpers; ++h)
+                    tasks.emplace_back(run);
+            }
+            available.notify_all();
+        }
+        run();
+        std::unique_lock lock(loop->mutex);
+        loop->finished.wait(lock, [&] { return loop->completed == count; });
+        if (loop->error)
+            std::rethrow_exception(loop->error);
+    }
+};
+
+/**
+ * A sorted string dictionary split by key range into shards, each an array of its own, which answers the queries with
+ * the ranks and positions of the whole dictionary. A query is routed to its shard by a binary search on the first
+ * string of each shard, and the positions are offset by the prefix sums of the sizes of the shards. The shards are
+ * built in parallel, the batches of queries are split by shard and answered in parallel, and a dictionary loaded from
+ * disk maps each shard only when a query first needs it.
+ */
+template<typename Array = RearCodedArray>
+class ShardedRearCodedArray {
+    using Options = typename Array::Options;
+
+    mutable std::vector<std::optional<Array>> shards;
+    mutable std::unique_ptr<std::once_flag[]> loaded; ///< Whether each shard was mapped, if loaded lazily
+    std::string path;                                 ///< The manifest of the lazily loaded shards, else empty
+    bool verify_checksums = false;
+    std::vector<std::string> boundaries;              ///< First string of each shard but the first
+    std::vector<size_t> offsets;                      ///< Position of the first string of each shard, and the size
+    std::unique_ptr<ThreadPool> pool;
+
+    static std::string shard_path(const std::string &path, size_t k) { return path + "." + std::to_string(k); }
+
+    explicit ShardedRearCodedArray(size_t threads) : pool(std::make_unique<ThreadPool>(threads)) {}
+
+    const Array &shard(size_t k) const {
+        if (!path.empty())
+            std::call_once(loaded[k], [&] { shards[k].emplace(Array::load(shard_path(path, k), verify_checksums)); });
+        return *shards[k];
+    }
+
+    size_t shard_of_string(std::string_view s) const {
+        return size_t(std::upper_bound(boundaries.begin(), boundaries.end(), s) - boundaries.begin());
+    }
+
+    size_t shard_of_position(size_t i) const {
+        return size_t(std::upper_bound(offsets.begin(), offsets.end() - 1, i) - offsets.begin()) - 1;
+    }
+
+    /** Returns the indices of the elements of [first, last) grouped by the shard given by shard_of, in order. */
+    template<typename RandomIt, typename ShardOf>
+    std::vector<std::vector<size_t>> route(RandomIt first, RandomIt last, ShardOf shard_of) const {
+        std::vector<std::vector<size_t>> routes(shards.size());
+        for (auto it = first; it != last; ++it)
+            routes[shard_of(*it)].push_back(size_t(it - first));
+        return routes;
+    }
+
+public:
+
+    /**
+     * Creates a dictionary with the sorted strings in [first, last) split into shards_count shards of about the same
+     * number of strings, which are built with the given options by up to threads threads. The same threads answer the
+     * batches of queries.
+     */
+    template<typename RandomIt>
+    ShardedRearCodedArray(RandomIt first, RandomIt last, size_t shards_count, const Options &options = {},
+                          size_t threads = std::thread::hardware_concurrency())
+        : ShardedRearCodedArray(threads) {
+        using category = typename std::iterator_traits<RandomIt>::iterator_category;
+        static_assert(std::is_base_of_v<std::random_access_iterator_tag, category>, "the input must be random-access");
+        auto size = size_t(std::distance(first, last));
+        shards_count = std::clamp<size_t>(shards_count, 1, std::max<size_t>(1, size));
+        for (size_t k = 0; k <= shards_count; ++k)
+            offsets.push_back(size * k / shards_count);
+        for (size_t k = 1; k < shards_count; ++k)
+            boundaries.emplace_back(*(first + offsets[k]));
+        for (size_t k = 1; k < shards_count; ++k)
+            if (*(first + offsets[k]) <= *(first + offsets[k] - 1))
+                throw std::invalid_argument("data is not sorted");
+
+        auto shard_options = options;
+        shard_options.threads = 1;
+        shards.resize(shards_count);
+        pool->parallel_for(shards_count, [&](size_t k) {
+            shards[k].emplace(first + offsets[k], first + offsets[k + 1], shard_options);
+        });
+    }
+
+    size_t size() const { return offsets.back(); }
+
+    size_t shards_count() const { return shards.size(); }
+
+    /**
+     * Returns the number of shards mapped in memory, which is less than shards_count() if loaded lazily. Must not run
+     * concurrently with the queries.
+     */
+    size_t loaded_shards_count() const {
+        return size_t(std::count_if(shards.begin(), shards.end(), [](auto &s) { return s.has_value(); }));
+    }
+
+    /** Returns the memory taken by the shards loaded so far and by the routing structures. */
+    size_t size_in_bytes() const {
+        size_t bytes = sizeof(*this) + offsets.size() * sizeof(size_t) + pool->threads() * sizeof(std::thread);
+        for (auto &b: boundaries)
+            bytes += sizeof(b) + b.capacity();
+        for (auto &s: shards)
+            bytes += s ? s->size_in_bytes() : sizeof(s);
+        return bytes;
+    }
+
+    /** Writes the string at position i to out, followed by a \0, and returns the end of what was written. */
+    char *access(size_t i, char *out) const {
+        auto k = shard_of_position(i);
+        return shard(k).access(i - offsets[k], out);
+    }
+
+    /** Returns the number of strings <= s. */
+    size_t rank(std::string_view s) const {
+        auto k = shard_of_string(s);
+        return offsets[k] + shard(k).rank(s);
+    }
+
+    std::optional<size_t> locate(std::string_view s) const {
+        auto k = shard_of_string(s);
+        auto p = shard(k).locate(s);
+        return p ? std::optional<size_t>(offsets[k] + *p) : std::nullopt;
+    }
+
+    /**
+     * Writes to out[j] the rank of the j-th string in [first, last), which need not be sorted. The queries are
+     * grouped by shard, and the groups answered in parallel, each with rank_batch if sorted or rank_interleaved.
+     */
+    template<typename RandomIt, typename OutputIt>
+    void rank_batch(RandomIt first, RandomIt last, OutputIt out) const {
+        auto routes = route(first, last, [&](std::string_view s) { return shard_of_string(s); });
+        pool->parallel_for(shards.size(), [&](size_t k) {
+            auto &indices = routes[k];
+            if (indices.empty())
+                return;
+            std::vector<std::string_view> queries;
+            queries.reserve(indices.size());
+            for (auto j: indices)
+                queries.emplace_back(*(first + j));
+            std::vector<size_t> ranks(queries.size());
+            if (std::is_sorted(queries.begin(), queries.end()))
+                shard(k).rank_batch(queries.begin(), queries.end(), ranks.begin());
+            else
+                shard(k).rank_interleaved(queries.begin(), queries.end(), ranks.begin());
+            for (size_t q = 0; q < indices.size(); ++q)
+                out[indices[q]] = offsets[k] + ranks[q];
+        });
+    }
+
+    /**
+     * Sets out[j] to the string at the j-th position in [first, last), which need not be sorted. The positions are
+     * grouped by shard, and the groups answered in parallel, each with a sorted access_batch.
+     */
+    template<typename RandomIt>
+    void access_batch(RandomIt first, RandomIt last, std::vector<std::string> &out) const {
+        out.resize(size_t(std::distance(first, last)));
+        auto routes = route(first, last, [&](size_t i) { return shard_of_position(i); });
+        pool->parallel_for(shards.size(), [&](size_t k) {
+            auto &indices = routes[k];
+            std::sort(indices.begin(), indices.end(), [&](auto a, auto b) { return first[a] < first[b]; });
+            std::vector<size_t> positions;
+            positions.reserve(indices.size());
+            for (auto j: indices)
+                positions.push_back(first[j] - offsets[k]);
+            size_t q = 0;
+            shard(k).access_batch(positions.begin(), positions.end(), [&](std::string_view s) {
+                out[indices[q++]] = s;
+            });
+        });
+    }
+
+    /** Writes the manifest to path, and each shard to path followed by a dot and the index of the shard. */
+    void save(const std::string &path) const {
+        std::ofstream out(path, std::ios::binary);
+        rca::Writer writer(out, rca::Layout::ShardManifest);
+        writer.param(shards.size());
+        std::vector<uint64_t> offsets_section(offsets.begin(), offsets.end());
+        std::string boundaries_section;
+        for (auto &b: boundaries)
+            boundaries_section.append(b.c_str(), b.size() + 1);
+        writer.section(offsets_section);
+        writer.section(boundaries_section);
+        writer.finish();
+        for (size_t k = 0; k < shards.size(); ++k)
+            shard(k).save(shard_path(path, k));
+    }
+
+    /**
+     * Reads a dictionary written by save(). Only the manifest is read now: each shard is mapped by the first query
+     * that needs it, so that opening a dictionary with many shards is cheap, and the unused ones take no memory.
+     */
+    static ShardedRearCodedArray load(const std::string &path, bool verify_checksums = false,
+                                      size_t threads = std::thread::hardware_concurrency()) {
+        rca::MappedFile file(path, rca::Layout::ShardManifest, verify_checksums);
+        if (file.params_count() != 1 || file.sections_count() != 2 || file.param(0) == 0)
+            throw std::runtime_error(path + ": incompatible ShardedRearCodedArray parameters");
+        auto shards_count = size_t(file.param(0));
+        auto offsets_section = file.section<std::vector<uint64_t>>(0);
+        auto boundaries_section = file.section<std::string>(1);
+        if (offsets_section.size() != shards_count + 1 || offsets_section[0] != 0
+            || !std::is_sorted(offsets_section.begin(), offsets_section.end()))
+            throw std::runtime_error(path + ": inconsistent shard offsets");
+
+        ShardedRearCodedArray result(threads);
+        result.path = path;
+        result.verify_checksums = verify_checksums;
+        result.offsets.assign(offsets_section.begin(), offsets_section.end());
+        for (size_t i = 0; i < boundaries_section.size(); ++i) {
+            std::string_view rest(boundaries_section.data() + i, boundaries_section.size() - i);
+            auto end = rest.find('\0');
+            if (end == std::string_view::npos)
+                break;
+            result.boundaries.emplace_back(rest.substr(0, end));
+            i += end;
+        }
+        if (result.boundaries.size() + 1 != shards_count)
+            throw std::runtime_error(path + ": inconsistent shard boundaries");
+        result.shards.resize(shards_count);
+        result.loaded = std::make_unique<std::once_flag[]>(shards_count);
+        return result;
+    }
+};
+
+}
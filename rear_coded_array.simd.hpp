@@ -0,0 +1,182 @@
+//
+// Vectorized string kernels shared by the RearCodedArray variants, with runtime dispatch and a portable fallback.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RCA_SIMD_X86 1
+#endif
+
+namespace rca {
+
+/**
+ * Bytes that must be readable after the terminator of the strings that the kernels scan, or that they compare with
+ * a pattern. The arrays append them to their data and headers, so that loads of whole vectors never leave the buffers.
+ */
+constexpr size_t simd_padding = 32;
+
+namespace simd {
+
+/** Returns the length of the common prefix of a[0, len) and b[0, len), comparing 8 bytes at a time. */
+inline size_t mismatch_scalar(const char *a, const char *b, size_t len) {
+    size_t i = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + 8 <= len; i += 8) {
+        uint64_t x, y;
+        std::memcpy(&x, a + i, 8);
+        std::memcpy(&y, b + i, 8);
+        if (x != y)
+            return i + __builtin_ctzll(x ^ y) / 8;
+    }
+#endif
+    while (i != len && a[i] == b[i])
+        ++i;
+    return i;
+}
+
+#ifdef RCA_SIMD_X86
+
+/** Whether the CPU supports AVX2, checked once at startup rather than behind a guard on every call. */
+#ifdef __AVX2__
+inline const bool has_avx2 = true;
+#else
+inline const bool has_avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+#endif
+
+/** SSE2 is part of x86-64, so the 16-byte kernels need no dispatch. */
+inline size_t mismatch_sse2(const char *a, const char *b, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        auto y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        auto differ = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y))) ^ 0xffff;
+        if (differ != 0)
+            return i + __builtin_ctz(differ);
+    }
+    return i + mismatch_scalar(a + i, b + i, len - i);
+}
+
+__attribute__((target("avx2")))
+inline size_t mismatch_avx2(const char *a, const char *b, size_t len) {
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        auto y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        auto differ = ~uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)));
+        if (differ != 0)
+            return i + __builtin_ctz(differ);
+    }
+    return i + mismatch_sse2(a + i, b + i, len - i);
+}
+
+inline size_t string_length_sse2(const char *s) {
+    auto zero = _mm_setzero_si128();
+    for (size_t i = 0;; i += 16) {
+        auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+        auto nul = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)));
+        if (nul != 0)
+            return i + __builtin_ctz(nul);
+    }
+}
+
+#endif
+
+}
+
+/**
+ * Returns the length of the common prefix of a[0, len) and b, which is read in whole vectors up to the one containing
+ * the first mismatch, so it must be followed by simd_padding readable bytes if shorter than len. Exactly len bytes of a
+ * are read.
+ */
+inline size_t mismatch(const char *a, const char *b, size_t len) {
+#ifdef RCA_SIMD_X86
+    if (len >= 32 && simd::has_avx2)
+        return simd::mismatch_avx2(a, b, len);
+    return simd::mismatch_sse2(a, b, len);
+#else
+    return simd::mismatch_scalar(a, b, len);
+#endif
+}
+
+/**
+ * Given the rear lengths r and the suffix lengths s of 8 consecutive rear-coded strings, where 255 marks a length
+ * stored elsewhere, returns how many of the leading strings share with their predecessor a prefix longer than lcp,
+ * i.e. can be skipped by a search whose pattern shares lcp bytes with the string before them, whose length is given.
+ * That length is advanced to the one of the last skipped string, and bytes is increased by their suffix lengths. The
+ * skip stops at the first escaped length.
+ */
+inline size_t skip_lcp_above(const uint8_t *r, const uint8_t *s, size_t lcp, size_t &length, size_t &bytes) {
+#ifdef RCA_SIMD_X86
+    if (lcp >= length)
+        return 0;
+    auto zero = _mm_setzero_si128();
+    auto rear = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(r)), zero);
+    auto suffix = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(s)), zero);
+    auto prefix_sums = [](__m128i x) {
+        x = _mm_add_epi16(x, _mm_slli_si128(x, 2));
+        x = _mm_add_epi16(x, _mm_slli_si128(x, 4));
+        return _mm_add_epi16(x, _mm_slli_si128(x, 8));
+    };
+    auto deltas = prefix_sums(_mm_sub_epi16(suffix, rear));   // Length of each string minus the initial one
+    auto lcps = _mm_sub_epi16(_mm_slli_si128(deltas, 2), rear); // LCP with the predecessor minus the initial length
+    auto threshold = std::max<int64_t>(int64_t(lcp) - int64_t(length), -30000); // The lanes are within +-2032
+    auto escape = _mm_set1_epi16(255);
+    auto escaped = _mm_or_si128(_mm_cmpeq_epi16(rear, escape), _mm_cmpeq_epi16(suffix, escape));
+    auto skippable = _mm_andnot_si128(escaped, _mm_cmpgt_epi16(lcps, _mm_set1_epi16(int16_t(threshold))));
+    auto k = size_t(__builtin_ctz(~uint32_t(_mm_movemask_epi8(skippable)))) / 2;
+    if (k > 0) {
+        alignas(16) int16_t lengths[8], suffix_bytes[8];
+        _mm_store_si128(reinterpret_cast<__m128i *>(lengths), deltas);
+        _mm_store_si128(reinterpret_cast<__m128i *>(suffix_bytes), prefix_sums(suffix));
+        length += lengths[k - 1];
+        bytes += size_t(suffix_bytes[k - 1]);
+    }
+    return k;
+#else
+    size_t k = 0;
+    for (; k < 8 && r[k] != 255 && s[k] != 255 && length - r[k] > lcp; ++k) {
+        length += s[k] - r[k];
+        bytes += s[k];
+    }
+    return k;
+#endif
+}
+
+/** Returns whether the buffer ends with simd_padding zeros, as the arrays loaded from a file must. */
+inline bool padded(const char *data, size_t size) {
+    if (size < simd_padding)
+        return false;
+    static const char zeros[simd_padding] = {};
+    return std::memcmp(data + size - simd_padding, zeros, simd_padding) == 0;
+}
+
+/**
+ * Like std::strlen, but inlined and without the alignment prologue, which suits the short suffixes skipped by the
+ * searches. These rarely span more than one vector, so 16-byte loads are used even if the CPU has AVX2. The string
+ * must be followed by simd_padding readable bytes.
+ */
+inline size_t string_length(const char *s) {
+#ifdef RCA_SIMD_X86
+    return simd::string_length_sse2(s);
+#else
+    return std::strlen(s);
+#endif
+}
+
+}
+
+/** Returns the length of the longest common prefix of a and b. */
+inline size_t compute_lcp(std::string_view a, std::string_view b) {
+    return rca::mismatch(a.data(), b.data(), std::min(a.length(), b.length()));
+}
+
+inline size_t compute_lcp(const char *a, const char *b) {
+    return compute_lcp(std::string_view(a), std::string_view(b));
+}
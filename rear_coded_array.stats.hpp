@@ -0,0 +1,174 @@
+//
+// Build statistics and the opt-in query instrumentation of the RearCodedArray variants.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace rca {
+
+/** Statistics on the input and the layout of an array, which the constructors gather instead of printing them. */
+struct BuildStats {
+    uint64_t strings = 0;
+    uint64_t input_bytes = 0;    ///< Bytes of the strings, each with its terminator
+    uint64_t max_length = 0;
+    uint64_t max_lcp = 0;        ///< Of consecutive strings
+    uint64_t sum_lcp = 0;
+    uint64_t max_header_lcp = 0; ///< Of consecutive headers
+    uint64_t sum_header_lcp = 0;
+    uint64_t block_bytes = 0;
+    uint64_t blocks = 0;
+    uint64_t bytes = 0;          ///< The size_in_bytes() of the array
+    uint64_t filter_bytes = 0;
+
+    double avg_length() const { return strings == 0 ? 0 : double(input_bytes - strings) / double(strings); }
+    double avg_lcp() const { return strings == 0 ? 0 : double(sum_lcp) / double(strings); }
+    double avg_header_lcp() const { return blocks == 0 ? 0 : double(sum_header_lcp) / double(blocks); }
+    double strings_per_block() const { return blocks == 0 ? 0 : double(strings) / double(blocks); }
+
+    void print(std::ostream &out) const {
+        out << "Input bytes             " << input_bytes << std::endl
+            << "Input avg length        " << avg_length() << std::endl
+            << "Input avg LCP           " << avg_lcp() << ", max " << max_lcp << std::endl
+            << "RC block_bytes          " << block_bytes << std::endl
+            << "RC bytes                " << bytes << std::endl
+            << "RC blocks               " << blocks << std::endl
+            << "RC headers avg LCP      " << avg_header_lcp() << ", max " << max_header_lcp << std::endl
+            << "Avg strings per block   " << strings_per_block() << std::endl;
+        if (filter_bytes > 0)
+            out << "Filter bytes            " << filter_bytes << std::endl;
+    }
+};
+
+/**
+ * The fields of BuildStats that describe the input, which the arrays save as parameters, in this order, since they
+ * cannot be recomputed from the array. The other fields are filled from the array itself.
+ */
+constexpr uint64_t BuildStats::*build_stats_input_fields[] = {
+    &BuildStats::input_bytes, &BuildStats::max_length, &BuildStats::max_lcp, &BuildStats::sum_lcp,
+    &BuildStats::max_header_lcp, &BuildStats::sum_header_lcp
+};
+
+/** A histogram of latencies in power-of-two buckets of nanoseconds. */
+struct LatencyHistogram {
+    static constexpr size_t buckets_count = 40;
+
+    uint64_t buckets[buckets_count] = {}; ///< Bucket b > 0 counts the latencies in [2^b, 2^(b+1)), the first also 0
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+
+    void add(uint64_t ns) {
+        auto b = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+        ++buckets[std::min<size_t>(b, buckets_count - 1)];
+        ++count;
+        sum_ns += ns;
+    }
+
+    double mean_ns() const { return count == 0 ? 0 : double(sum_ns) / double(count); }
+
+    /** Returns an upper bound on the q-quantile of the latencies, i.e. the end of the bucket where it falls. */
+    uint64_t quantile_ns(double q) const {
+        auto rank = uint64_t(q * double(count));
+        uint64_t seen = 0;
+        for (size_t b = 0; b < buckets_count; ++b) {
+            seen += buckets[b];
+            if (seen > rank)
+                return (uint64_t(2) << b) - 1;
+        }
+        return count == 0 ? 0 : (uint64_t(2) << (buckets_count - 1)) - 1;
+    }
+
+    LatencyHistogram &operator+=(const LatencyHistogram &other) {
+        for (size_t b = 0; b < buckets_count; ++b)
+            buckets[b] += other.buckets[b];
+        count += other.count;
+        sum_ns += other.sum_ns;
+        return *this;
+    }
+};
+
+/**
+ * Counters of the work done by the queries of a thread, which are updated only if RCA_INSTRUMENT is defined when the
+ * arrays are compiled. The counters of several threads can be summed with +=.
+ */
+struct QueryStats {
+    uint64_t header_comparisons = 0; ///< Steps of the searches on the headers
+    uint64_t strings_decoded = 0;    ///< Strings of the blocks read by the searches and accesses
+    uint64_t strings_skipped = 0;    ///< Strings that the searches skipped by their lengths in the split layout
+    uint64_t bytes_decoded = 0;      ///< Bytes of the suffixes of the strings decoded
+    uint64_t early_exits = 0;        ///< Searches in a block that stopped before its last string
+    uint64_t filter_rejections = 0;  ///< Calls to locate answered by the filter
+    LatencyHistogram rank_ns;
+    LatencyHistogram access_ns;
+
+    QueryStats &operator+=(const QueryStats &other) {
+        header_comparisons += other.header_comparisons;
+        strings_decoded += other.strings_decoded;
+        strings_skipped += other.strings_skipped;
+        bytes_decoded += other.bytes_decoded;
+        early_exits += other.early_exits;
+        filter_rejections += other.filter_rejections;
+        rank_ns += other.rank_ns;
+        access_ns += other.access_ns;
+        return *this;
+    }
+
+    void print(std::ostream &out) const {
+        auto latencies = [&](const char *name, const LatencyHistogram &h) {
+            out << name << h.count << " queries, mean " << h.mean_ns() << " ns, p50 < " << h.quantile_ns(0.5)
+                << " ns, p99 < " << h.quantile_ns(0.99) << " ns" << std::endl;
+        };
+        out << "Header comparisons      " << header_comparisons << std::endl
+            << "Strings decoded         " << strings_decoded << std::endl
+            << "Strings skipped         " << strings_skipped << std::endl
+            << "Bytes decoded           " << bytes_decoded << std::endl
+            << "Early exits             " << early_exits << std::endl
+            << "Filter rejections       " << filter_rejections << std::endl;
+        latencies("Rank latency            ", rank_ns);
+        latencies("Access latency          ", access_ns);
+    }
+};
+
+/** Returns the counters of the queries run by the calling thread. */
+inline QueryStats &query_stats() {
+    thread_local QueryStats stats;
+    return stats;
+}
+
+/** Adds to a histogram the time from its construction to its destruction. */
+class ScopedLatency {
+    using clock = std::chrono::steady_clock;
+
+    LatencyHistogram &histogram;
+    clock::time_point start;
+
+public:
+
+    explicit ScopedLatency(LatencyHistogram &histogram) : histogram(histogram), start(clock::now()) {}
+
+    ScopedLatency(const ScopedLatency &) = delete;
+    ScopedLatency &operator=(const ScopedLatency &) = delete;
+
+    ~ScopedLatency() {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+        histogram.add(uint64_t(ns));
+    }
+};
+
+}
+
+/*
+ * The hooks of the instrumentation, which compile to nothing unless RCA_INSTRUMENT is defined, so that the default
+ * build pays neither for the counters nor for the clock reads.
+ */
+#ifdef RCA_INSTRUMENT
+#define RCA_COUNT(counter, value) (rca::query_stats().counter += (value))
+#define RCA_LATENCY(histogram) rca::ScopedLatency rca_scoped_latency(rca::query_stats().histogram)
+#else
+#define RCA_COUNT(counter, value) ((void) 0)
+#define RCA_LATENCY(histogram) ((void) 0)
+#endif
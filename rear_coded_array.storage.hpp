@@ -0,0 +1,311 @@
+//
+// Storage and serialization utilities shared by the RearCodedArray variants.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rca {
+
+/** An immutable array that either owns its elements or views them in a memory-mapped file. */
+template<typename Container>
+class Storage {
+public:
+    using value_type = typename Container::value_type;
+
+private:
+    Container owned;
+    std::shared_ptr<const void> mapping; ///< Keeps alive the mapped file that ptr points into, null if owned
+    const value_type *ptr;
+    size_t length;
+
+public:
+
+    Storage() : ptr(owned.data()), length(0) {}
+
+    Storage(Container &&container) : owned(std::move(container)), ptr(owned.data()), length(owned.size()) {}
+
+    Storage(std::shared_ptr<const void> mapping, const value_type *ptr, size_t length)
+        : mapping(std::move(mapping)), ptr(ptr), length(length) {}
+
+    Storage(const Storage &other)
+        : owned(other.owned), mapping(other.mapping), ptr(mapping ? other.ptr : owned.data()), length(other.length) {}
+
+    Storage(Storage &&other) noexcept
+        : owned(std::move(other.owned)), mapping(std::move(other.mapping)), ptr(mapping ? other.ptr : owned.data()),
+          length(other.length) {
+        other.ptr = other.owned.data();
+        other.length = 0;
+    }
+
+    Storage &operator=(Storage other) {
+        owned = std::move(other.owned);
+        mapping = std::move(other.mapping);
+        ptr = mapping ? other.ptr : owned.data();
+        length = other.length;
+        return *this;
+    }
+
+    /** Returns true if the elements are viewed in a memory-mapped file. */
+    bool mapped() const { return mapping != nullptr; }
+
+    const value_type *data() const { return ptr; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    const value_type &operator[](size_t i) const { return ptr[i]; }
+    const value_type &back() const { return ptr[length - 1]; }
+    const value_type *begin() const { return ptr; }
+    const value_type *end() const { return ptr + length; }
+};
+
+/** A fast streaming checksum, which runs four multiply-rotate lanes over 8-byte words. */
+class Checksum {
+    uint64_t lanes[4] = {0x9e3779b97f4a7c15ull, 0xbf58476d1ce4e5b9ull, 0x94d049bb133111ebull, 0x2545f4914f6cdd1dull};
+    unsigned char pending[32];
+    size_t pending_bytes = 0;
+    uint64_t total_bytes = 0;
+
+    void consume(const unsigned char *block) {
+        for (size_t k = 0; k < 4; ++k) {
+            uint64_t word;
+            std::memcpy(&word, block + 8 * k, 8);
+            lanes[k] = (lanes[k] ^ word) * 0x9fb21c651e98df25ull;
+            lanes[k] = lanes[k] << 31 | lanes[k] >> 33;
+        }
+    }
+
+public:
+
+    void update(const void *ptr, size_t bytes) {
+        if (bytes == 0)
+            return;
+        auto p = static_cast<const unsigned char *>(ptr);
+        total_bytes += bytes;
+        if (pending_bytes > 0) {
+            auto take = std::min(bytes, sizeof(pending) - pending_bytes);
+            std::memcpy(pending + pending_bytes, p, take);
+            pending_bytes += take;
+            p += take;
+            bytes -= take;
+            if (pending_bytes < sizeof(pending))
+                return;
+            consume(pending);
+            pending_bytes = 0;
+        }
+        for (; bytes >= sizeof(pending); p += sizeof(pending), bytes -= sizeof(pending))
+            consume(p);
+        std::memcpy(pending, p, bytes);
+        pending_bytes = bytes;
+    }
+
+    uint64_t digest() const {
+        auto copy = *this;
+        std::memset(copy.pending + copy.pending_bytes, 0, sizeof(pending) - copy.pending_bytes);
+        copy.consume(copy.pending);
+        uint64_t h = total_bytes;
+        for (auto lane: copy.lanes) {
+            h = (h ^ lane) * 0xff51afd7ed558ccdull;
+            h ^= h >> 32;
+        }
+        return h;
+    }
+
+    static uint64_t of(const void *ptr, size_t bytes) {
+        Checksum c;
+        c.update(ptr, bytes);
+        return c.digest();
+    }
+};
+
+/*
+ * The on-disk format is a prologue, followed by the sections of the array at 64-byte aligned offsets, followed by a
+ * trailer with the build parameters and the table of sections, and finally by a fixed-size footer. Since the trailer
+ * is written last, a file can be produced in a single sequential pass.
+ */
+
+constexpr char format_magic[8] = {'R', 'C', 'A', 'R', 'R', 'A', 'Y', '\0'};
+constexpr uint32_t format_version = 9;
+constexpr size_t section_alignment = 64;
+
+enum class Layout : uint32_t {
+    InlineHeaders = 1,   ///< rear_coded_array.hpp
+    SeparateHeaders = 2, ///< rear_coded_array.separate_headers.hpp
+    ShardManifest = 3    ///< rear_coded_array.sharded.hpp, whose shards are in files of the layouts above
+};
+
+struct Prologue {
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;
+    uint64_t byte_order; ///< Must read as 0x0102030405060708
+};
+
+struct SectionEntry {
+    uint64_t offset;
+    uint64_t bytes;
+    uint64_t checksum;
+};
+
+struct Footer {
+    uint64_t params_count;
+    uint64_t sections_count;
+    uint64_t trailer_offset;
+    uint64_t trailer_checksum;
+};
+
+/** Writes the sections and parameters of an array in a single sequential pass over an output stream. */
+class Writer {
+    std::ostream &out;
+    uint64_t offset;
+    std::vector<uint64_t> params;
+    std::vector<SectionEntry> sections;
+    Checksum checksum;
+
+    void put(const void *ptr, size_t bytes) {
+        out.write(static_cast<const char *>(ptr), std::streamsize(bytes));
+        offset += bytes;
+    }
+
+public:
+
+    Writer(std::ostream &out, Layout layout) : out(out), offset(0) {
+        Prologue prologue{{}, format_version, uint32_t(layout), 0x0102030405060708ull};
+        std::memcpy(prologue.magic, format_magic, sizeof(format_magic));
+        put(&prologue, sizeof(prologue));
+    }
+
+    void param(uint64_t value) { params.push_back(value); }
+
+    void begin_section() {
+        static const char zeros[section_alignment] = {};
+        put(zeros, (section_alignment - offset % section_alignment) % section_alignment);
+        sections.push_back({offset, 0, 0});
+        checksum = Checksum();
+    }
+
+    void write(const void *ptr, size_t bytes) {
+        put(ptr, bytes);
+        checksum.update(ptr, bytes);
+        sections.back().bytes += bytes;
+    }
+
+    void end_section() { sections.back().checksum = checksum.digest(); }
+
+    template<typename Container>
+    void section(const Container &c) {
+        begin_section();
+        write(c.data(), c.size() * sizeof(c.data()[0]));
+        end_section();
+    }
+
+    void finish() {
+        static const char zeros[sizeof(uint64_t)] = {};
+        put(zeros, (sizeof(uint64_t) - offset % sizeof(uint64_t)) % sizeof(uint64_t));
+        Footer footer{params.size(), sections.size(), offset, 0};
+        Checksum trailer_checksum;
+        trailer_checksum.update(params.data(), params.size() * sizeof(params[0]));
+        trailer_checksum.update(sections.data(), sections.size() * sizeof(sections[0]));
+        footer.trailer_checksum = trailer_checksum.digest();
+        put(params.data(), params.size() * sizeof(params[0]));
+        put(sections.data(), sections.size() * sizeof(sections[0]));
+        put(&footer, sizeof(footer));
+        out.flush();
+        if (!out)
+            throw std::runtime_error("failed to write the array");
+    }
+};
+
+/** A read-only, shared memory mapping of a file written by Writer, whose sections can be viewed without copies. */
+class MappedFile {
+    std::shared_ptr<const void> mapping;
+    const char *base;
+    size_t bytes;
+    const uint64_t *params;
+    const SectionEntry *sections;
+    Footer footer;
+
+    [[noreturn]] static void fail(const std::string &path, const std::string &what) {
+        throw std::runtime_error(path + ": " + what);
+    }
+
+public:
+
+    MappedFile(const std::string &path, Layout layout, bool verify_checksums) {
+        auto fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            fail(path, std::strerror(errno));
+        struct stat st{};
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            fail(path, std::strerror(errno));
+        }
+        bytes = size_t(st.st_size);
+        if (bytes < sizeof(Prologue) + sizeof(Footer)) {
+            ::close(fd);
+            fail(path, "file too small");
+        }
+        auto addr = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED)
+            fail(path, std::strerror(errno));
+        auto length = bytes;
+        mapping = std::shared_ptr<const void>(addr, [length](const void *p) { munmap(const_cast<void *>(p), length); });
+        base = static_cast<const char *>(addr);
+
+        Prologue prologue;
+        std::memcpy(&prologue, base, sizeof(prologue));
+        if (std::memcmp(prologue.magic, format_magic, sizeof(format_magic)) != 0)
+            fail(path, "not a RearCodedArray file");
+        if (prologue.byte_order != 0x0102030405060708ull)
+            fail(path, "written with a different byte order");
+        if (prologue.version != format_version)
+            fail(path, "unsupported format version " + std::to_string(prologue.version));
+        if (prologue.layout != uint32_t(layout))
+            fail(path, "written by a different RearCodedArray variant");
+
+        std::memcpy(&footer, base + bytes - sizeof(Footer), sizeof(Footer));
+        auto trailer_bytes = footer.params_count * sizeof(uint64_t) + footer.sections_count * sizeof(SectionEntry);
+        if (footer.trailer_offset % sizeof(uint64_t) != 0 || footer.trailer_offset + trailer_bytes + sizeof(Footer) != bytes)
+            fail(path, "corrupted trailer");
+        params = reinterpret_cast<const uint64_t *>(base + footer.trailer_offset);
+        sections = reinterpret_cast<const SectionEntry *>(params + footer.params_count);
+        if (Checksum::of(params, trailer_bytes) != footer.trailer_checksum)
+            fail(path, "trailer checksum mismatch");
+        for (size_t i = 0; i < footer.sections_count; ++i) {
+            if (sections[i].offset % section_alignment != 0 || sections[i].offset + sections[i].bytes > bytes)
+                fail(path, "corrupted section table");
+            if (verify_checksums && Checksum::of(base + sections[i].offset, sections[i].bytes) != sections[i].checksum)
+                fail(path, "checksum mismatch in section " + std::to_string(i));
+        }
+    }
+
+    size_t params_count() const { return footer.params_count; }
+    size_t sections_count() const { return footer.sections_count; }
+
+    uint64_t param(size_t i) const { return params[i]; }
+
+    template<typename Container>
+    Storage<Container> section(size_t i) const {
+        using T = typename Container::value_type;
+        if (sections[i].bytes % sizeof(T) != 0)
+            throw std::runtime_error("section " + std::to_string(i) + " has a wrong size");
+        auto ptr = reinterpret_cast<const T *>(base + sections[i].offset);
+        return {mapping, ptr, size_t(sections[i].bytes / sizeof(T))};
+    }
+};
+
+}
@@ -0,0 +1,124 @@
+//
+// Choice of the block size and layout of a RearCodedArray from a sample of its workload.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "rear_coded_array.separate_headers.hpp"
+
+namespace rca {
+
+/** A sample of the queries that an array will answer, whose sizes give the mix of ranks and accesses. */
+struct Workload {
+    std::vector<std::string> ranks;
+    std::vector<size_t> accesses;
+};
+
+/** The configurations that tune() tries: each block size, with and without split streams if requested. */
+struct TuningSpace {
+    std::vector<size_t> block_bytes = {32, 64, 128, 256, 512, 1024, 2048, 4096};
+    bool split_streams = true; ///< Whether to try the split layout in addition to the classic one
+    size_t repetitions = 3;    ///< Runs of the workload on each configuration, of which the fastest counts
+};
+
+template<typename Options>
+struct TuningCandidate {
+    Options options;
+    size_t bytes;     ///< The size_in_bytes() of the array built with the options
+    double rank_ns;   ///< Mean time of the ranks of the workload
+    double access_ns; ///< Mean time of the accesses of the workload
+    double query_ns;  ///< Mean time of the queries of the workload
+};
+
+template<typename Options>
+struct TuningResult {
+    Options best;                                      ///< The fastest configuration within the space budget
+    std::vector<TuningCandidate<Options>> front;      ///< The configurations on the space/time Pareto front
+    std::vector<TuningCandidate<Options>> candidates; ///< All the configurations tried, in the order of the space
+};
+
+/**
+ * Builds an array on the sorted strings in [first, last) for each configuration in the space, times the workload on
+ * it, and returns the fastest configuration that takes at most space_budget bytes, or the smallest one if none does,
+ * along with the Pareto front of space and time, by increasing space. The other options are taken from base. The
+ * tuning takes about one construction and one run of the workload per configuration and repetition, so a large
+ * dictionary can be tuned on a contiguous part of it, which preserves its LCPs.
+ */
+template<typename Array = RearCodedArray, typename RandomIt>
+TuningResult<typename Array::Options> tune(RandomIt first, RandomIt last, const Workload &workload,
+                                           size_t space_budget, const typename Array::Options &base = {},
+                                           const TuningSpace &space = {}) {
+    using Options = typename Array::Options;
+    using timer = std::chrono::steady_clock;
+
+    auto size = size_t(std::distance(first, last));
+    auto queries = workload.ranks.size() + workload.accesses.size();
+    if (queries == 0)
+        throw std::invalid_argument("the workload has no queries");
+    if (!workload.accesses.empty() && *std::max_element(workload.accesses.begin(), workload.accesses.end()) >= size)
+        throw std::invalid_argument("the workload accesses a position out of range");
+    if (space.block_bytes.empty())
+        throw std::invalid_argument("no block size to try");
+
+    auto mean_ns = [&](const auto &run, size_t count) {
+        if (count == 0)
+            return 0.;
+        auto best = std::numeric_limits<double>::max();
+        for (size_t r = 0; r < std::max<size_t>(1, space.repetitions); ++r) {
+            auto start = timer::now();
+            run();
+            auto elapsed = std::chrono::duration<double, std::nano>(timer::now() - start).count();
+            best = std::min(best, elapsed / double(count));
+        }
+        return best;
+    };
+
+    TuningResult<Options> result;
+    for (auto split: {false, true}) {
+        if (split && !space.split_streams)
+            continue;
+        for (auto block_bytes: space.block_bytes) {
+            auto options = base;
+            options.block_bytes = block_bytes;
+            options.split_streams = split;
+            Array array(first, last, options);
+            std::vector<char> buffer(array.build_stats().max_length + 1);
+            size_t sink = 0;
+            auto rank_ns = mean_ns([&] {
+                for (auto &s: workload.ranks)
+                    sink += array.rank(s);
+            }, workload.ranks.size());
+            auto access_ns = mean_ns([&] {
+                for (auto i: workload.accesses)
+                    sink += size_t(array.access(i, buffer.data()) - buffer.data());
+            }, workload.accesses.size());
+            [[maybe_unused]] volatile auto tmp = sink;
+            auto query_ns = (rank_ns * double(workload.ranks.size()) + access_ns * double(workload.accesses.size()))
+                / double(queries);
+            result.candidates.push_back({options, array.size_in_bytes(), rank_ns, access_ns, query_ns});
+        }
+    }
+
+    auto &candidates = result.candidates;
+    std::sort(candidates.begin(), candidates.end(), [](auto &a, auto &b) {
+        return a.bytes < b.bytes || (a.bytes == b.bytes && a.query_ns < b.query_ns);
+    });
+    for (auto &c: candidates)
+        if (result.front.empty() || c.query_ns < result.front.back().query_ns)
+            result.front.push_back(c);
+
+    result.best = result.front.front().options;
+    for (auto &c: result.front)
+        if (c.bytes <= space_budget)
+            result.best = c.options; // The front is by increasing space and decreasing time
+    return result;
+}
+
+}